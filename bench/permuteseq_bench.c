@@ -0,0 +1,366 @@
+/*
+ * permuteseq_bench.c
+ *
+ * Microbenchmark of the cipher of permuteseq, built without the server
+ * with "make bench". For intervals whose sizes are powers of 4, just
+ * below and just above them, and the full int64 range, it reports the
+ * time per value and the throughput of encryption and decryption, one
+ * value at a time and in batches, and the average and maximum number
+ * of passes through the Feistel network per value.
+ *
+ * With -b, the times are compared to those of a previous output of the
+ * program with the same options, and it fails if any of them is more
+ * than the tolerance (-t, in percent) above the time of the baseline.
+ * -m repeats each measurement and keeps the fastest, to reduce the noise.
+ *
+ * Usage: permuteseq_bench [-a algorithm] [-r rounds] [-n values] [-k key]
+ *                         [-m measurements] [-b baseline [-t tolerance]]
+ *
+ * By Daniel Vérité, 2016-2023. See LICENSE.md
+ */
+
+#include "postgres_fe.h"
+
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "permuteseq.h"
+
+/* Number of values per batch, as used by permute_nextval_array() */
+#define BENCH_BATCH	1000
+
+/* Called by the cipher, see permuteseq_cipher.c */
+void
+cipher_walk_failed(int64 value, int walk_max)
+{
+	fprintf(stderr, "infinite cycle walking prevented for value " INT64_FORMAT " (%d loops)\n",
+		value, walk_max);
+	exit(1);
+}
+
+static double
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Defeats the elimination of the results by the compiler */
+static volatile int64 checksum;
+
+/* Times per value of a previous run, see load_baseline() */
+#define BENCH_MAX_BASELINE	1024
+
+typedef struct BaselineEntry
+{
+	char		size[16];
+	char		op[20];
+	double		ns;		/* time per value */
+} BaselineEntry;
+
+static BaselineEntry baseline[BENCH_MAX_BASELINE];
+static int baseline_count = 0;
+static double tolerance = 20.0;	/* percent */
+static int regressions = 0;
+
+/*
+ * Read the times per value from the output of a previous run, which must
+ * have been made with the same options, as its first line tells.
+ */
+static void
+load_baseline(const char *path, const char *title)
+{
+	FILE *f = fopen(path, "r");
+	char line[256];
+	int lineno = 0;
+
+	if (f == NULL)
+	{
+		fprintf(stderr, "could not open baseline \"%s\": %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		BaselineEntry *e;
+		char op[20];
+		int len;
+
+		line[strcspn(line, "\n")] = '\0';
+		if (++lineno == 1)
+		{
+			if (strcmp(line, title) != 0)
+			{
+				fprintf(stderr, "baseline \"%s\" was measured with different options:\n%s\n",
+					path, line);
+				exit(1);
+			}
+			continue;
+		}
+
+		/* the lines of report(), the others are skipped */
+		if (strlen(line) < 28 || baseline_count >= BENCH_MAX_BASELINE)
+			continue;
+		e = &baseline[baseline_count];
+		if (sscanf(line, "%15s", e->size) != 1 ||
+		    sscanf(line + 28, "%lf", &e->ns) != 1)
+			continue;
+		memcpy(op, line + 11, 16);
+		op[16] = '\0';
+		for (len = 16; len > 0 && op[len - 1] == ' '; len--)
+			op[len - 1] = '\0';
+		if (strstr(op, "passes") != NULL)
+			continue;
+		strcpy(e->op, op);
+		baseline_count++;
+	}
+	fclose(f);
+
+	if (baseline_count == 0)
+	{
+		fprintf(stderr, "no times found in baseline \"%s\"\n", path);
+		exit(1);
+	}
+}
+
+/*
+ * Compare a time per value to the baseline, counting it as a
+ * regression if it's above the tolerance.
+ */
+static void
+check_baseline(const char *size, const char *op, double ns)
+{
+	int i;
+
+	for (i = 0; i < baseline_count; i++)
+	{
+		if (strcmp(baseline[i].size, size) == 0 && strcmp(baseline[i].op, op) == 0)
+		{
+			if (ns > baseline[i].ns * (1.0 + tolerance / 100.0))
+			{
+				fprintf(stderr, "regression: %s %s: %.1f ns/value, baseline %.1f (+%.0f%%)\n",
+					size, op, ns, baseline[i].ns,
+					(ns / baseline[i].ns - 1.0) * 100.0);
+				regressions++;
+			}
+			return;
+		}
+	}
+}
+
+static void
+report(const char *size, const char *op, double ns, int count)
+{
+	printf("%-10s %-16s %10.1f %12.2f\n", size, op, ns / count, count * 1e3 / ns);
+	if (baseline_count > 0)
+		check_baseline(size, op, round(ns / count * 10.0) / 10.0);
+}
+
+/*
+ * Benchmark the interval [minval,maxval], with values spread
+ * over the interval.
+ */
+static void
+bench_interval(const char *size, int64 minval, int64 maxval, uint64 key,
+	       const CipherOptions *opts, int count, int measures)
+{
+	CipherContext ctx;
+	int64 *clear = malloc(count * sizeof(int64));
+	int64 *crypt = malloc(count * sizeof(int64));
+	uint64 max_offset = (uint64) maxval - (uint64) minval;
+	uint64 stride = 0x9E3779B97F4A7C15ULL;	/* spreads the values */
+	double start;
+	double best;
+	int64 acc = 0;
+	int direction;
+	int i;
+	int m;
+
+	if (clear == NULL || crypt == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	cipher_init(&ctx, minval, maxval, key, opts);
+
+	for (i = 0; i < count; i++)
+	{
+		uint64 offset = (uint64) i * stride;
+
+		if (max_offset != PG_UINT64_MAX)
+			offset %= max_offset + 1;
+		clear[i] = (int64) ((uint64) minval + offset);
+	}
+
+	best = 0;
+	for (m = 0; m < measures; m++)
+	{
+		start = now_ns();
+		for (i = 0; i < count; i++)
+			acc += crypt[i] = cycle_walking_cipher(&ctx, clear[i], 0);
+		start = now_ns() - start;
+		if (m == 0 || start < best)
+			best = start;
+	}
+	report(size, "encrypt", best, count);
+
+	best = 0;
+	for (m = 0; m < measures; m++)
+	{
+		start = now_ns();
+		for (i = 0; i < count; i++)
+			acc += cycle_walking_cipher(&ctx, crypt[i], 1);
+		start = now_ns() - start;
+		if (m == 0 || start < best)
+			best = start;
+	}
+	report(size, "decrypt", best, count);
+
+	for (direction = 0; direction <= 1; direction++)
+	{
+		const int64 *in = (direction == 0) ? clear : crypt;
+		int64 out[BENCH_BATCH];
+
+		best = 0;
+		for (m = 0; m < measures; m++)
+		{
+			start = now_ns();
+			for (i = 0; i < count; i += BENCH_BATCH)
+			{
+				int n = Min(BENCH_BATCH, count - i);
+
+				cycle_walking_cipher_batch(&ctx, in + i, out, n, direction);
+				acc += out[0];
+			}
+			start = now_ns() - start;
+			if (m == 0 || start < best)
+				best = start;
+		}
+		report(size, direction == 0 ? "batch encrypt" : "batch decrypt",
+		       best, count);
+	}
+
+	for (direction = 0; direction <= 1; direction++)
+	{
+		const int64 *in = (direction == 0) ? clear : crypt;
+		int64 total = 0;
+		int max = 0;
+
+		for (i = 0; i < count; i++)
+		{
+			int passes = cipher_passes(&ctx, in[i], direction);
+
+			total += passes;
+			max = Max(max, passes);
+		}
+		printf("%-10s %-16s %10.3f %12d\n", size,
+		       direction == 0 ? "encrypt passes" : "decrypt passes",
+		       (double) total / count, max);
+	}
+
+	checksum += acc;
+	free(clear);
+	free(crypt);
+}
+
+int
+main(int argc, char **argv)
+{
+	CipherOptions opts;
+	uint64 key = 123456789;
+	int count = 100000;
+	int measures = 1;
+	const char *baseline_path = NULL;
+	char title[128];
+	int c;
+	int k;
+
+	opts.algorithm = PERMUTESEQ_ALGO_DEFAULT;
+	opts.rounds = PERMUTESEQ_DEFAULT_ROUNDS;
+
+	while ((c = getopt(argc, argv, "a:r:n:k:m:b:t:")) != -1)
+	{
+		switch (c)
+		{
+			case 'a':
+				opts.algorithm = atoi(optarg);
+				break;
+			case 'r':
+				opts.rounds = atoi(optarg);
+				break;
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 'k':
+				key = strtoull(optarg, NULL, 10);
+				break;
+			case 'm':
+				measures = atoi(optarg);
+				break;
+			case 'b':
+				baseline_path = optarg;
+				break;
+			case 't':
+				tolerance = atof(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-a algorithm] [-r rounds] [-n values] [-k key]\n"
+					"          [-m measurements] [-b baseline [-t tolerance]]\n",
+					argv[0]);
+				exit(1);
+		}
+	}
+
+	if (opts.algorithm < 1 || opts.algorithm > PERMUTESEQ_ALGO_MAX ||
+	    opts.rounds < PERMUTESEQ_MIN_ROUNDS || opts.rounds > PERMUTESEQ_MAX_ROUNDS ||
+	    count <= 0 || measures <= 0 || tolerance < 0)
+	{
+		fprintf(stderr, "invalid algorithm, number of rounds, number of values, measurements or tolerance\n");
+		exit(1);
+	}
+
+	snprintf(title, sizeof(title), "algorithm %d, %d rounds, %d values, %s rounds implementation",
+		 opts.algorithm, opts.rounds, count, select_feistel_rounds());
+	if (baseline_path != NULL)
+		load_baseline(baseline_path, title);
+
+	printf("%s\n", title);
+	printf("%-10s %-16s %10s %12s\n", "size", "operation", "ns/value", "Mvalues/s");
+	printf("%-10s %-16s %10s %12s\n", "", "", "avg passes", "max passes");
+
+	/* sizes 4^k-1, 4^k and 4^k+1, except 4^1-1 since the intervals
+	   must have at least 4 values */
+	for (k = 1; k < 32; k++)
+	{
+		uint64 size = (uint64) 1 << (2 * k);
+		char label[32];
+		int d;
+
+		for (d = -1; d <= 1; d++)
+		{
+			if (k == 1 && d < 0)
+				continue;
+			if (d == 0)
+				snprintf(label, sizeof(label), "4^%d", k);
+			else
+				snprintf(label, sizeof(label), "4^%d%s1", k, d < 0 ? "-" : "+");
+			bench_interval(label, 1, (int64) (size + d), key, &opts, count, measures);
+		}
+	}
+
+	bench_interval("2^64", PG_INT64_MIN, PG_INT64_MAX, key, &opts, count, measures);
+
+	if (regressions > 0)
+	{
+		fprintf(stderr, "%d times per value more than %.0f%% above the baseline\n",
+			regressions, tolerance);
+		return 2;
+	}
+
+	return 0;
+}
@@ -0,0 +1 @@
+SELECT permute_nextval('permuteseq_bench_seq'::regclass, 123456789);
@@ -0,0 +1 @@
+SELECT permute_nextval_array('permuteseq_bench_seq'::regclass, 123456789, 100);
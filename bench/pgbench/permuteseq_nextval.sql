@@ -0,0 +1 @@
+SELECT permuteseq_nextval('permuteseq_bench_seq'::regclass);
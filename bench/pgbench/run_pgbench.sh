@@ -0,0 +1,26 @@
+#!/bin/sh
+#
+# Run the pgbench scripts of this directory with increasing numbers
+# of clients, against the database given by the usual libpq environment
+# variables (PGDATABASE, PGHOST, ...).
+#
+# Usage: run_pgbench.sh [duration in seconds] [client counts...]
+# Set PGOPTIONS="-c permuteseq.prealloc_block_size=1000" for example to
+# benchmark with preallocation.
+
+set -e
+
+dir=$(dirname "$0")
+duration=${1:-10}
+[ $# -gt 0 ] && shift
+clients=${*:-"1 4 16 64"}
+
+psql -X -q -v ON_ERROR_STOP=1 -f "$dir/setup.sql" > /dev/null
+
+for script in permute_nextval permuteseq_nextval permute_nextval_array; do
+	for c in $clients; do
+		tps=$(pgbench -n -M prepared -T "$duration" -c "$c" -j "$c" \
+			-f "$dir/$script.sql" | sed -n 's/^tps = \([0-9.]*\).*/\1/p')
+		echo "$script clients=$c tps=$tps"
+	done
+done
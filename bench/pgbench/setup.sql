@@ -0,0 +1,5 @@
+-- Objects used by the pgbench scripts, see run_pgbench.sh
+CREATE EXTENSION IF NOT EXISTS permuteseq;
+DROP SEQUENCE IF EXISTS permuteseq_bench_seq;
+CREATE SEQUENCE permuteseq_bench_seq MINVALUE 1 MAXVALUE 10000000000 CYCLE;
+SELECT permuteseq_register('permuteseq_bench_seq', 123456789);
@@ -9,19 +9,61 @@
 #include <inttypes.h>
 
 #include "postgres.h"
+#include "access/genam.h"
 #include "access/hash.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "access/xloginsert.h"
+#if PG_VERSION_NUM >= 120000
+#include "access/table.h"
+#endif
 #include "c.h"
+#include "catalog/indexing.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_extension.h"
 #include "catalog/pg_sequence.h"
+#include "catalog/pg_type.h"
+#include "commands/extension.h"
 #include "commands/sequence.h"
+#include "commands/trigger.h"
 #include "executor/executor.h"
+#include "executor/spi.h"
+#include "funcapi.h"
 #include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/bufmgr.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "tcop/utility.h"
 #include "utils/acl.h"
+#include "utils/array.h"
+#include "utils/builtins.h"
+#include "utils/fmgroids.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
+#include "utils/rel.h"
 #include "utils/syscache.h"
+#include "utils/timestamp.h"
 #include "fmgr.h"
 #if PG_VERSION_NUM >= 100000
 #include "utils/fmgrprotos.h"
+#else
+#include "utils/int8.h"
 #endif
+#if PG_VERSION_NUM >= 120000
+#include "catalog/pg_operator.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/supportnodes.h"
+#include "parser/parse_func.h"
+#endif
+
+#include "permuteseq.h"
 
 PG_MODULE_MAGIC;
 
@@ -33,15 +75,147 @@ PG_MODULE_MAGIC;
 #define PG_INT64_MAX	INT64CONST(0x7FFFFFFFFFFFFFFF)
 #endif
 
+#if PG_VERSION_NUM < 120000
+#define table_open(r, l)	heap_open(r, l)
+#define table_close(r, l)	heap_close(r, l)
+#endif
+
+/*
+ * The permuteseq_sequences table, created by the extension script,
+ * holds the options of the permutation of each sequence.
+ */
+#define SEQUENCES_TABLE_NAME	"permuteseq_sequences"
+#define Anum_permuteseq_sequences_seq		1
+#define Anum_permuteseq_sequences_algorithm	2
+#define Anum_permuteseq_sequences_rounds	3
+#define Anum_permuteseq_sequences_crypt_key	4
+
+/*
+ * The permuteseq_types table maps the types created by
+ * permuteseq_create_type() to their registered sequence.
+ */
+#define TYPES_TABLE_NAME	"permuteseq_types"
+#define Anum_permuteseq_types_typ		1
+#define Anum_permuteseq_types_seq		2
+
+/*
+ * Number of positions of a sequence claimed at once by permute_nextval()
+ * and permuteseq_nextval(), or 0 to claim them one by one.
+ */
+static int prealloc_block_size = 0;
+
+/*
+ * Maximum number of values of an interval for which the permutation is
+ * precomputed into lookup tables, or 0 to disable them.
+ */
+static int lookup_table_threshold = 65536;
+
+/*
+ * Statistics of all backends, in shared memory when the library is
+ * in shared_preload_libraries. Each backend adds its counters
+ * (permuteseq_local_stats) to them at the end of its transactions.
+ */
+typedef struct PermuteseqSharedStats
+{
+	slock_t		mutex;
+	PermuteseqStats	stats;
+	TimestampTz	stats_reset;
+} PermuteseqSharedStats;
+
+static PermuteseqSharedStats *shared_stats = NULL;
+
+/*
+ * Number of slots of the shared cache of cipher contexts, or 0 to disable
+ * it. It's only used when the library is in shared_preload_libraries.
+ */
+static int shared_cache_size = 1024;
+
+/*
+ * Slot of the shared cache of cipher contexts, holding the state
+ * computed by cipher_init() for a range, key and options, so that
+ * backends find it already computed by other backends.
+ * The slots are written without a lock, by a backend that changes
+ * changecount from an even value to the next odd value, and back to an
+ * even value when done. Readers copy the context between two reads of
+ * changecount, and take the copy as a miss if changecount was odd or
+ * has changed, without retrying. 0 means the slot is empty.
+ */
+typedef struct SharedCipherSlot
+{
+	pg_atomic_uint32 changecount;
+	CipherContext ctx;
+} SharedCipherSlot;
+
+/* Number of slots tried for a given hash */
+#define SHARED_CACHE_PROBES	4
+
+static SharedCipherSlot *shared_ciphers = NULL;
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+
+void _PG_init(void);
+
+static Size permuteseq_shmem_size(void);
+static void permuteseq_shmem_startup(void);
+#if PG_VERSION_NUM >= 150000
+static void permuteseq_shmem_request(void);
+#endif
+static void permuteseq_xact_callback(XactEvent event, void *arg);
 
 Datum permute_nextval(PG_FUNCTION_ARGS);
+Datum permute_nextval_batch(PG_FUNCTION_ARGS);
+Datum permute_nextval_array(PG_FUNCTION_ARGS);
 Datum reverse_permute(PG_FUNCTION_ARGS);
+Datum reverse_permute_array(PG_FUNCTION_ARGS);
+Datum reverse_permute_rows(PG_FUNCTION_ARGS);
 Datum range_encrypt_element(PG_FUNCTION_ARGS);
 Datum range_decrypt_element(PG_FUNCTION_ARGS);
+Datum permute_position(PG_FUNCTION_ARGS);
+Datum reverse_permutes_to(PG_FUNCTION_ARGS);
+Datum range_decrypts_to(PG_FUNCTION_ARGS);
+Datum permuteseq_support(PG_FUNCTION_ARGS);
+Datum range_encrypt_array(PG_FUNCTION_ARGS);
+Datum range_decrypt_array(PG_FUNCTION_ARGS);
+Datum range_encrypt_versioned(PG_FUNCTION_ARGS);
+Datum range_decrypt_versioned(PG_FUNCTION_ARGS);
+Datum range_key_version(PG_FUNCTION_ARGS);
+Datum permute_nextval_versioned(PG_FUNCTION_ARGS);
+Datum reverse_permute_versioned(PG_FUNCTION_ARGS);
+Datum range_expected_walks(PG_FUNCTION_ARGS);
+Datum range_permutation(PG_FUNCTION_ARGS);
+Datum range_permutation_chunk(PG_FUNCTION_ARGS);
+Datum range_sample(PG_FUNCTION_ARGS);
+Datum range_sample_filtered(PG_FUNCTION_ARGS);
+Datum range_permutation_window(PG_FUNCTION_ARGS);
+Datum range_value_at(PG_FUNCTION_ARGS);
+Datum range_position_of(PG_FUNCTION_ARGS);
+Datum permuteseq_set_options(PG_FUNCTION_ARGS);
+Datum permuteseq_sequences_trigger(PG_FUNCTION_ARGS);
+Datum permuteseq_register(PG_FUNCTION_ARGS);
+Datum permuteseq_nextval(PG_FUNCTION_ARGS);
+Datum permuteseq_reverse(PG_FUNCTION_ARGS);
+Datum permuteseq_type_in(PG_FUNCTION_ARGS);
+Datum permuteseq_type_out(PG_FUNCTION_ARGS);
+Datum permuteseq_type_recv(PG_FUNCTION_ARGS);
+Datum permuteseq_type_send(PG_FUNCTION_ARGS);
+Datum permuteseq_stats(PG_FUNCTION_ARGS);
+Datum permuteseq_stats_reset(PG_FUNCTION_ARGS);
+
+static void lookup_table_attach(CipherContext *ctx);
 
-static int64 cycle_walking_cipher(int64 minval, int64 maxval,
-				  int64 value, uint64 key,
-				  int direction);
+static void cipher_init_shared(CipherContext *ctx,
+			       int64 minval, int64 maxval,
+			       uint64 crypt_key,
+			       const CipherOptions *opts);
+
+static CipherContext *get_cached_cipher(FunctionCallInfo fcinfo,
+					int64 minval, int64 maxval,
+					uint64 crypt_key,
+					const CipherOptions *opts);
 
 /*
  * Compute the difference between the min and max of the sequence,
@@ -61,8 +235,295 @@ static bool check_sequence_range(int64 minv, int64 maxv)
 }
 
 
+/*
+ * Check the options of a permutation, whether they come from the
+ * arguments of a function or from the permuteseq_sequences table.
+ */
+static void
+check_cipher_options(const CipherOptions *opts)
+{
+	if (opts->algorithm < 1 || opts->algorithm > PERMUTESEQ_ALGO_MAX)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid algorithm: %d", opts->algorithm),
+				errhint("Valid algorithms are from 1 to %d.",
+					PERMUTESEQ_ALGO_MAX)));
+	}
+	if (opts->rounds < PERMUTESEQ_MIN_ROUNDS || opts->rounds > PERMUTESEQ_MAX_ROUNDS)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid number of rounds: %d", opts->rounds),
+				errhint("The number of rounds must be between %d and %d.",
+					PERMUTESEQ_MIN_ROUNDS, PERMUTESEQ_MAX_ROUNDS)));
+	}
+}
+
+/*
+ * Check that a range is large enough for the cipher, with the same
+ * condition as for the sequences, so that the functions and the
+ * expressions they're rewritten into (see permuteseq_support()) fail
+ * alike.
+ */
+static void
+check_cipher_range(int64 minval, int64 maxval)
+{
+	if (!check_sequence_range(minval, maxval))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("range [%"PRId64",%"PRId64"] too short to be permuted",
+				       minval, maxval),
+				errhint("The range should contain at least 4 values.")));
+	}
+}
+
+/*
+ * Get the options from the optional arguments of a function, starting
+ * at argument argno, with defaults for the arguments not passed.
+ * The arguments are: algorithm, rounds.
+ */
+static void
+get_cipher_options_args(FunctionCallInfo fcinfo, int argno, CipherOptions *opts)
+{
+	opts->algorithm = (PG_NARGS() > argno) ? PG_GETARG_INT32(argno) :
+		PERMUTESEQ_ALGO_DEFAULT;
+	opts->rounds = (PG_NARGS() > argno + 1) ? PG_GETARG_INT32(argno + 1) :
+		PERMUTESEQ_DEFAULT_ROUNDS;
+
+	check_cipher_options(opts);
+}
+
+/*
+ * Backend-local cache of the bounds and options of the sequences used
+ * with permute_nextval() and reverse_permute(), keyed by sequence OID.
+ * For the sequences registered with a key, used by permuteseq_nextval()
+ * and permuteseq_reverse(), it also holds the cipher, so that the key
+ * and the range are processed only when the entry is filled.
+ * An entry is valid only for the user for whom the permissions on the
+ * sequence have been checked. Entries are invalidated when the
+ * pg_sequence or pg_class tuple of the sequence changes (ALTER SEQUENCE,
+ * GRANT, REVOKE, DROP), when any role membership changes, or when the
+ * permuteseq_sequences table changes.
+ * Invalidation only marks the entries as invalid, so that a pointer to
+ * an entry stays usable by its caller until the next lookup.
+ */
+typedef struct SequenceBoundsEntry
+{
+	Oid		seq_oid;	/* hash key, must be first */
+	bool		valid;
+	Oid		userid;		/* user allowed to read the bounds */
+	uint32		seq_hashvalue;	/* hash of seq_oid in SEQRELID */
+	uint32		rel_hashvalue;	/* hash of seq_oid in RELOID */
+	int64		minval;
+	int64		maxval;
+	CipherOptions	opts;
+	bool		registered;	/* has a key in permuteseq_sequences */
+	bool		encryptable;	/* the range is large enough to encrypt */
+	CipherContext	cipher;		/* set up with the key if registered */
+	/* positions claimed in advance, see next_preallocated_value() */
+	int64	   *prealloc_positions;
+	int64	   *prealloc_values;	/* the positions encrypted */
+	int		prealloc_size;		/* allocated size of the arrays */
+	int		prealloc_count;		/* number of positions claimed */
+	int		prealloc_next;		/* index of the next one to return */
+	bool		prealloc_encrypted;	/* prealloc_values are set with: */
+	uint64		prealloc_key;
+	CipherOptions	prealloc_opts;
+} SequenceBoundsEntry;
+
+static HTAB *sequence_bounds_cache = NULL;
+
+/* OID of the permuteseq_sequences table when last looked up */
+static Oid sequences_table_oid = InvalidOid;
+
+static void
+sequence_bounds_invalidate(Datum arg, int cacheid, uint32 hashvalue)
+{
+	HASH_SEQ_STATUS status;
+	SequenceBoundsEntry *entry;
+
+	hash_seq_init(&status, sequence_bounds_cache);
+	while ((entry = (SequenceBoundsEntry *) hash_seq_search(&status)) != NULL)
+	{
+		/* hashvalue 0 means a cache reset */
+		if (hashvalue == 0 || cacheid == AUTHMEMROLEMEM ||
+		    (cacheid == SEQRELID && entry->seq_hashvalue == hashvalue) ||
+		    (cacheid == RELOID && entry->rel_hashvalue == hashvalue))
+		{
+			entry->valid = false;
+		}
+	}
+}
+
+static void
+sequence_options_invalidate(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS status;
+	SequenceBoundsEntry *entry;
+
+	/* InvalidOid means all relations */
+	if (relid != InvalidOid && relid != sequences_table_oid)
+		return;
+
+	hash_seq_init(&status, sequence_bounds_cache);
+	while ((entry = (SequenceBoundsEntry *) hash_seq_search(&status)) != NULL)
+		entry->valid = false;
+}
+
+static void
+init_sequence_bounds_cache(void)
+{
+	HASHCTL ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(SequenceBoundsEntry);
+	sequence_bounds_cache = hash_create("permuteseq sequence bounds",
+					    32, &ctl,
+					    HASH_ELEM | HASH_BLOBS);
+
+	CacheRegisterSyscacheCallback(SEQRELID, sequence_bounds_invalidate, (Datum) 0);
+	CacheRegisterSyscacheCallback(RELOID, sequence_bounds_invalidate, (Datum) 0);
+	CacheRegisterSyscacheCallback(AUTHMEMROLEMEM, sequence_bounds_invalidate, (Datum) 0);
+	CacheRegisterRelcacheCallback(sequence_options_invalidate, (Datum) 0);
+}
+
+#if PG_VERSION_NUM < 160000
+/*
+ * get_extension_schema() is static in the server before PG 16, so
+ * read the namespace of the extension from pg_extension ourselves.
+ * Return InvalidOid if the extension doesn't exist.
+ */
+static Oid
+get_extension_schema(Oid ext_oid)
+{
+	Oid		result = InvalidOid;
+	Relation	rel;
+	SysScanDesc	scandesc;
+	HeapTuple	tuple;
+	ScanKeyData	entry[1];
+
+	rel = table_open(ExtensionRelationId, AccessShareLock);
+
+	ScanKeyInit(&entry[0],
+#if PG_VERSION_NUM >= 120000
+		    Anum_pg_extension_oid,
+#else
+		    ObjectIdAttributeNumber,
+#endif
+		    BTEqualStrategyNumber, F_OIDEQ,
+		    ObjectIdGetDatum(ext_oid));
+
+	scandesc = systable_beginscan(rel, ExtensionOidIndexId, true,
+				      NULL, 1, entry);
+
+	tuple = systable_getnext(scandesc);
+	if (HeapTupleIsValid(tuple))
+		result = ((Form_pg_extension) GETSTRUCT(tuple))->extnamespace;
+
+	systable_endscan(scandesc);
+	table_close(rel, AccessShareLock);
+
+	return result;
+}
+#endif
+
+/*
+ * Return the OID of a table of the extension, or InvalidOid if
+ * the extension is not installed in the current database.
+ */
+static Oid
+get_extension_table_oid(const char *relname)
+{
+	Oid ext_oid = get_extension_oid("permuteseq", true);
+
+	if (!OidIsValid(ext_oid))
+		return InvalidOid;
+
+	return get_relname_relid(relname, get_extension_schema(ext_oid));
+}
+
+/*
+ * Return the OID of the permuteseq_sequences table, or InvalidOid if
+ * the extension is not installed in the current database.
+ */
+static Oid
+get_sequences_table_oid(void)
+{
+	sequences_table_oid = get_extension_table_oid(SEQUENCES_TABLE_NAME);
+	return sequences_table_oid;
+}
+
+/*
+ * Read the options of the permutation of a sequence from the
+ * permuteseq_sequences table, using the defaults if there's no entry,
+ * and its key if it has been registered with one.
+ * The table is read directly, not through SQL, so that users of the
+ * sequences don't need privileges on it.
+ */
+static void
+fetch_sequence_options(Oid seq_oid, CipherOptions *opts, bool *registered,
+		       uint64 *crypt_key)
+{
+	Oid relid = get_sequences_table_oid();
+	Relation rel;
+	SysScanDesc scan;
+	ScanKeyData key;
+	HeapTuple tuple;
+
+	opts->algorithm = PERMUTESEQ_ALGO_DEFAULT;
+	opts->rounds = PERMUTESEQ_DEFAULT_ROUNDS;
+	*registered = false;
+	*crypt_key = 0;
+
+	if (!OidIsValid(relid))
+		return;
+
+	rel = table_open(relid, AccessShareLock);
+
+	ScanKeyInit(&key,
+		    Anum_permuteseq_sequences_seq,
+		    BTEqualStrategyNumber, F_OIDEQ,
+		    ObjectIdGetDatum(seq_oid));
+
+	scan = systable_beginscan(rel, InvalidOid, false, NULL, 1, &key);
+
+	tuple = systable_getnext(scan);
+	if (HeapTupleIsValid(tuple))
+	{
+		bool isnull;
+		Datum d;
+
+		d = heap_getattr(tuple, Anum_permuteseq_sequences_algorithm,
+				 RelationGetDescr(rel), &isnull);
+		if (!isnull)
+			opts->algorithm = DatumGetInt32(d);
+
+		d = heap_getattr(tuple, Anum_permuteseq_sequences_rounds,
+				 RelationGetDescr(rel), &isnull);
+		if (!isnull)
+			opts->rounds = DatumGetInt32(d);
+
+		d = heap_getattr(tuple, Anum_permuteseq_sequences_crypt_key,
+				 RelationGetDescr(rel), &isnull);
+		if (!isnull)
+		{
+			*registered = true;
+			*crypt_key = DatumGetInt64(d);
+		}
+	}
+
+	systable_endscan(scan);
+	table_close(rel, AccessShareLock);
+
+	check_cipher_options(opts);
+}
+
+/*
+ * Read the min,max of the sequence from the catalog, checking that the
+ * current user has permissions to use it.
+ */
 static void
-get_sequence_min_max(Oid seq_oid, int64 *minval, int64 *maxval)
+fetch_sequence_min_max(Oid seq_oid, int64 *minval, int64 *maxval)
 {
 #if PG_VERSION_NUM < 160000
 	bool isnull;
@@ -99,233 +560,2868 @@ get_sequence_min_max(Oid seq_oid, int64 *minval, int64 *maxval)
 #endif
 }
 
-PG_FUNCTION_INFO_V1(permute_nextval);
-
-
 /*
- * Input: a sequence (through its OID) and a 64-bit encryption key.
- * Take the nextval (64-bit integer) and return its associated
- * unique value in the pseudo-random permutation resulting from
- * encrypting the sequence.
- * The output is constrained to the boundaries of the sequence by
- * using a cycle-walking cipher on top of a Feistel network.
+ * Get the valid cache entry of a sequence, filling it if necessary.
  */
-Datum
-permute_nextval(PG_FUNCTION_ARGS)
+static SequenceBoundsEntry *
+get_sequence_entry(Oid seq_oid)
 {
-	Datum seq_oid = PG_GETARG_DATUM(0);
-	uint64 crypt_key = PG_GETARG_INT64(1);
-	int64 minval, maxval, result, nextval;
+	SequenceBoundsEntry *entry;
+	bool found;
+	Oid userid = GetUserId();
 
-	get_sequence_min_max(seq_oid, &minval, &maxval);
+	if (sequence_bounds_cache == NULL)
+		init_sequence_bounds_cache();
 
-	/* Make sure that the sequence is large enough */
-	if (!check_sequence_range(minval, maxval))
+	entry = (SequenceBoundsEntry *) hash_search(sequence_bounds_cache,
+						    &seq_oid, HASH_ENTER, &found);
+	if (!found)
 	{
-		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				errmsg("sequence too short to encrypt."),
-				errhint("The difference between minimum and maximum values should be at least 3.")));
+		entry->valid = false;
+		entry->prealloc_positions = NULL;
+		entry->prealloc_values = NULL;
+		entry->prealloc_size = 0;
 	}
 
-	nextval = DatumGetInt64(DirectFunctionCall1(nextval_oid, seq_oid));
-
-	if (nextval < minval || nextval > maxval)
+	if (!entry->valid || entry->userid != userid)
 	{
-		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				errmsg("nextval of the sequence is outside the interval.")));
-	}
+		uint64 crypt_key;
 
-	result = cycle_walking_cipher(minval,
-				      maxval,
-				      nextval,
-				      crypt_key,
-				      0);
+		permuteseq_local_stats.bounds_misses++;
+		entry->valid = false;
+		/* the preallocated positions may no longer be valid or allowed */
+		entry->prealloc_count = 0;
+		entry->prealloc_next = 0;
+		/* may error out, leaving the entry invalid */
+		fetch_sequence_min_max(seq_oid, &entry->minval, &entry->maxval);
+		fetch_sequence_options(seq_oid, &entry->opts, &entry->registered,
+				       &crypt_key);
+		entry->encryptable = check_sequence_range(entry->minval, entry->maxval);
+		if (entry->registered)
+			cipher_init_shared(&entry->cipher, entry->minval, entry->maxval,
+					   crypt_key, &entry->opts);
+		entry->userid = userid;
+		entry->seq_hashvalue = GetSysCacheHashValue1(SEQRELID,
+							     ObjectIdGetDatum(seq_oid));
+		entry->rel_hashvalue = GetSysCacheHashValue1(RELOID,
+							     ObjectIdGetDatum(seq_oid));
+		entry->valid = true;
+	}
+	else
+		permuteseq_local_stats.bounds_hits++;
 
-	PG_RETURN_INT64(result);
+	return entry;
 }
 
-PG_FUNCTION_INFO_V1(reverse_permute);
-
 /*
- * Input: a sequence OID, a 64-bit value previously produced by permute_nextval(),
- * and the encryption key
- * Output: the original value of the sequence element
- * The sequence is used to obtain the minval and maxval for the
- * Feistel Network block size and the cycle walking algorithm.
+ * Get the min,max of the sequence and the options of its permutation,
+ * through the backend-local cache.
  */
-Datum
-reverse_permute(PG_FUNCTION_ARGS)
+static void
+get_sequence_min_max(Oid seq_oid, int64 *minval, int64 *maxval,
+		     CipherOptions *opts)
 {
-	Datum seq_oid = PG_GETARG_DATUM(0);
-	int64 value = PG_GETARG_INT64(1);
-	uint64 crypt_key = PG_GETARG_INT64(2);
-	int64 minval, maxval, result;
+	SequenceBoundsEntry *entry = get_sequence_entry(seq_oid);
 
-	get_sequence_min_max(seq_oid, &minval, &maxval);
+	*minval = entry->minval;
+	*maxval = entry->maxval;
+	*opts = entry->opts;
+}
+
+/*
+ * Get the cache entry of a sequence registered with permuteseq_register(),
+ * whose cipher is ready to use.
+ */
+static SequenceBoundsEntry *
+get_registered_sequence(Oid seq_oid)
+{
+	SequenceBoundsEntry *entry = get_sequence_entry(seq_oid);
 
-	if (maxval - minval < 4)
+	if (!entry->registered)
 	{
-		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				errmsg("sequence too short to decrypt."),
-				errhint("The difference between minimum and maximum values should be at least 4.")));
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				errmsg("sequence %s is not registered", get_rel_name(seq_oid)),
+				errhint("Register it with a key with permuteseq_register().")));
 	}
-
-	if (value < minval || value > maxval)
+	if (!entry->encryptable)
 	{
 		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				errmsg("value out of sequence bounds.")));
+				errmsg("sequence too short to encrypt."),
+				errhint("The difference between minimum and maximum values should be at least 3.")));
 	}
 
-	result = cycle_walking_cipher(minval,
-				      maxval,
-				      value,
-				      crypt_key,
-				      1);
+	lookup_table_attach(&entry->cipher);
 
-	PG_RETURN_INT64(result);
+	return entry;
 }
 
-PG_FUNCTION_INFO_V1(range_encrypt_element);
-
 /*
- * Direct interface to cycle_walking_cipher to encrypt/permute a value
- * from [minval,maxval] into itself, without a database sequence.
+ * Get the bounds of a sequence whose values are going to be encrypted,
+ * and make sure that the sequence is large enough.
  */
-Datum
-range_encrypt_element(PG_FUNCTION_ARGS)
+static void
+get_encryptable_sequence_range(Oid seq_oid, int64 *minval, int64 *maxval,
+			       CipherOptions *opts)
 {
-	int64 clearval = PG_GETARG_INT64(0);
-	int64 minval = PG_GETARG_INT64(1);
-	int64 maxval = PG_GETARG_INT64(2);
-	uint64 crypt_key = PG_GETARG_INT64(3);
+	get_sequence_min_max(seq_oid, minval, maxval, opts);
 
-	if (clearval < minval || clearval > maxval)
+	if (!check_sequence_range(*minval, *maxval))
 	{
 		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				errmsg("invalid value: %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
-				       clearval, minval, maxval)));
+				errmsg("sequence too short to encrypt."),
+				errhint("The difference between minimum and maximum values should be at least 3.")));
 	}
-
-	PG_RETURN_INT64(cycle_walking_cipher(minval,
-					     maxval,
-					     clearval,
-					     crypt_key,
-					     0));
 }
 
-PG_FUNCTION_INFO_V1(range_decrypt_element);
-
 /*
- * Direct interface to cycle_walking_cipher to decrypt/permute a value
- * from [minval,maxval] into itself, without a database sequence.
+ * Advance the sequence and return its new value, which must be
+ * inside [minval,maxval].
+ * check_permissions may be false when the caller has already
+ * advanced the same sequence in the same call.
  */
-Datum
-range_decrypt_element(PG_FUNCTION_ARGS)
+static int64
+sequence_next_position(Oid seq_oid, int64 minval, int64 maxval,
+		       bool check_permissions)
 {
-	int64 val = PG_GETARG_INT64(0);
-	int64 minval = PG_GETARG_INT64(1);
-	int64 maxval = PG_GETARG_INT64(2);
-	uint64 crypt_key = PG_GETARG_INT64(3);
+	int64 nextval;
 
-	if (val < minval || val > maxval)
+#if PG_VERSION_NUM >= 100000
+	nextval = nextval_internal(seq_oid, check_permissions);
+#else
+	nextval = DatumGetInt64(DirectFunctionCall1(nextval_oid,
+						    ObjectIdGetDatum(seq_oid)));
+#endif
+
+	if (nextval < minval || nextval > maxval)
 	{
 		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				errmsg("invalid value: %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
-				       val, minval, maxval)));
+				errmsg("nextval of the sequence is outside the interval.")));
 	}
 
-	PG_RETURN_INT64(cycle_walking_cipher(minval,
-					     maxval,
-					     val,
-					     crypt_key,
-					     1));
+	return nextval;
 }
 
-
 /*
- * Feistel network with cycle walking loop to produce a encrypted or
- * decrypted result between minval and maxval.
- *
- * direction: 0: encrypt, 1: decrypt
+ * Claim up to count positions of the sequence into positions, and
+ * return how many were claimed, at least one.
+ * With PG 10 and newer, the positions are taken with a single update
+ * of the sequence tuple, done as nextval() does it, under the lock of
+ * its buffer, so that a block costs one access to the sequence
+ * whatever its CACHE setting. This doesn't change currval() and
+ * lastval(). The block stops at the end of the sequence, where the
+ * position is then obtained from nextval(), which cycles or reports
+ * the error.
  */
-static int64
-cycle_walking_cipher(int64 minval, int64 maxval, int64 value, uint64 crypt_key, int direction)
+static int
+sequence_claim_positions(Oid seq_oid, int64 minval, int64 maxval,
+			 int count, int64 *positions)
 {
-	/* Arbitrary maximum number of "walks" along the results
-	   searching for a value inside the [minval,maxval] range.
-	   It's mainly to avoid an infinite loop in case the chain of
-	   results has a cycle (which would imply a bug somewhere). */
-	const int walk_max = 1000000;
+#if PG_VERSION_NUM >= 100000
+	Relation	seqrel;
+	HeapTuple	pgstuple;
+	Form_pg_sequence pgsform;
+	int64		incby, seqmin, seqmax;
+	Buffer		buf;
+	Page		page;
+	ItemId		lp;
+	HeapTupleData seqdatatuple;
+	Form_pg_sequence_data seq;
+	int64		first = 0;
+	int		n = 0;
+	int		i;
 
-	/* Half block size */
-	unsigned int hsz;
+	/* same lock, checks and errors as nextval() */
+	seqrel = relation_open(seq_oid, RowExclusiveLock);
 
-	/* Number of possible values for the output */
-	uint64 interval = maxval - minval + 1;
-	uint32 mask, Ki;
+	if (seqrel->rd_rel->relkind != RELKIND_SEQUENCE)
+		ereport(ERROR,
+			(errcode(ERRCODE_WRONG_OBJECT_TYPE),
+			 errmsg("\"%s\" is not a sequence",
+				RelationGetRelationName(seqrel))));
 
-	/* Number of rounds of the Feistel Network. Must be at least 3. */
-	const int NR = 9;
+	if (pg_class_aclcheck(seq_oid, GetUserId(), ACL_USAGE | ACL_UPDATE) != ACLCHECK_OK)
+		ereport(ERROR,
+			(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+			 errmsg("permission denied for sequence %s",
+				RelationGetRelationName(seqrel))));
 
-	uint32 l1, r1, l2, r2;
-	int walk_count = 0;
-	int i;
-	uint64 result;		/* offset into the interval */
+	if (!seqrel->rd_islocaltemp)
+		PreventCommandIfReadOnly("nextval()");
+	PreventCommandIfParallelMode("nextval()");
 
-	/* Compute the half block size: it's the smallest power of 2 such as two
-	   blocks are greater than or equal to the size of interval in bits. The
-	   half-blocks have equal lengths. */
-	hsz = 1;
-	while (hsz < 32 && ((uint64)1<<(2*hsz)) < interval)
-		hsz++;
+	pgstuple = SearchSysCache1(SEQRELID, ObjectIdGetDatum(seq_oid));
+	if (!HeapTupleIsValid(pgstuple))
+		elog(ERROR, "cache lookup failed for sequence %u", seq_oid);
+	pgsform = (Form_pg_sequence) GETSTRUCT(pgstuple);
+	incby = pgsform->seqincrement;
+	seqmin = Max(pgsform->seqmin, minval);
+	seqmax = Min(pgsform->seqmax, maxval);
+	ReleaseSysCache(pgstuple);
 
-	mask = (1 << hsz) - 1;
+	buf = ReadBuffer(seqrel, 0);
+	LockBuffer(buf, BUFFER_LOCK_EXCLUSIVE);
+	page = BufferGetPage(buf);
+	lp = PageGetItemId(page, FirstOffsetNumber);
+	seqdatatuple.t_data = (HeapTupleHeader) PageGetItem(page, lp);
+	seqdatatuple.t_len = ItemIdGetLength(lp);
+	seq = (Form_pg_sequence_data) GETSTRUCT(&seqdatatuple);
 
-	/* Scramble the key. This is not strictly necessary, but will
-	   help if the user-supplied key is weak, for instance with only a
-	   few right-most bits set. */
-	crypt_key = hash_uint32(crypt_key & 0xffffffff) |
-		((uint64)hash_uint32((crypt_key >> 32) & 0xffffffff)) << 32;
+	/* A tuple with an xmax is left for nextval() to fix. Otherwise
+	   count the positions left up to the bound of the sequence. */
+	if (HeapTupleHeaderGetRawXmax(seqdatatuple.t_data) == InvalidTransactionId)
+	{
+		bool room = true;
 
-	/* Initialize the two half blocks.
-	   Work with the offset into the interval rather than the actual value.
-	   This allows to use the full 32-bit range. */
-	l1 = (value - minval) >> hsz;
-	r1 = (value - minval) & mask;
+		first = seq->last_value;
+		if (seq->is_called)
+		{
+			/* overflow-safe test of first + incby against the bounds */
+			if (incby > 0)
+				room = !((seqmax >= 0 && first > seqmax - incby) ||
+					 (seqmax < 0 && first + incby > seqmax));
+			else
+				room = !((seqmin < 0 && first < seqmin - incby) ||
+					 (seqmin >= 0 && first + incby < seqmin));
+			if (room)
+				first += incby;
+		}
 
-	do			/* cycle walking */
-	{
-		for (i = 0; i < NR; i++) /* Feistel network */
+		if (room && first >= seqmin && first <= seqmax)
 		{
-			l2 = r1;
-			/* The subkey Ki for the round i is a sliding and cycling window
-			   of hsz bits over K, moving left to right, so each round takes
-			   different bits out of the crypt key. The round function is
-			   simply hash(Ri) XOR hash(Ki).
-			   When decrypting, Ki corresponds to the Kj of encryption with
-			   j=(NR-1-i), i.e. we iterate over subkeys in the reverse order. */
-			Ki = crypt_key >> ((hsz* (direction==0 ? i : NR-1-i))&0x3f);
-			Ki += (direction==0 ? i : NR-1-i);
-			r2 = (l1 ^ DatumGetUInt32(hash_uint32(r1))
-			         ^ DatumGetUInt32(hash_uint32(Ki))
-			      ) & mask;
-			l1 = l2;
-			r1 = r2;
+			uint64 left = (incby > 0) ?
+				((uint64) seqmax - (uint64) first) / (uint64) incby :
+				((uint64) first - (uint64) seqmin) / ((uint64) -(incby + 1) + 1);
+
+			n = (left < (uint64) count - 1) ? (int) left + 1 : count;
 		}
-		result = ((uint64)r1 << hsz) | l1;
-		/* swap one more time to prepare for the next cycle */
-		l1 = r2;
-		r1 = l2;
-	} while ((result > maxval - minval) && walk_count++ < walk_max);
+	}
 
-	if (walk_count >= walk_max)
+	if (n > 0)
 	{
-		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-				errmsg("infinite cycle walking prevented for value %"PRId64" (%d loops)",
-				       value, walk_max)));
-		
+		/* as in nextval(), have an xid so that the commit flushes the WAL */
+		if (RelationNeedsWAL(seqrel))
+			GetTopTransactionId();
+
+		START_CRIT_SECTION();
+
+		MarkBufferDirty(buf);
+
+		seq->last_value = first + (n - 1) * incby;
+		seq->is_called = true;
+		seq->log_cnt = 0;
+
+		if (RelationNeedsWAL(seqrel))
+		{
+			xl_seq_rec	xlrec;
+			XLogRecPtr	recptr;
+
+			XLogBeginInsert();
+			XLogRegisterBuffer(0, buf, REGBUF_WILL_INIT);
+#if PG_VERSION_NUM >= 160000
+			xlrec.locator = seqrel->rd_locator;
+#else
+			xlrec.node = seqrel->rd_node;
+#endif
+			XLogRegisterData((char *) &xlrec, sizeof(xl_seq_rec));
+			XLogRegisterData((char *) seqdatatuple.t_data, seqdatatuple.t_len);
+			recptr = XLogInsert(RM_SEQ_ID, XLOG_SEQ_LOG);
+			PageSetLSN(page, recptr);
+		}
+
+		END_CRIT_SECTION();
+	}
+
+	UnlockReleaseBuffer(buf);
+	relation_close(seqrel, NoLock);
+
+	for (i = 0; i < n; i++)
+		positions[i] = first + i * incby;
+
+	if (n > 0)
+		return n;
+
+	positions[0] = sequence_next_position(seq_oid, minval, maxval, true);
+	return 1;
+#else
+	int n;
+
+	for (n = 0; n < count; n++)
+		positions[n] = sequence_next_position(seq_oid, minval, maxval, n == 0);
+
+	return n;
+#endif
+}
+
+/*
+ * Return the next value of the sequence, encrypted with the cipher ctx,
+ * from the positions preallocated in the cache entry of the sequence.
+ * When they are all used, prealloc_block_size positions are claimed
+ * from the sequence at once by sequence_claim_positions() and encrypted
+ * together with cycle_walking_cipher_batch(). If the cipher differs
+ * from the one used for the encryption, the positions left are
+ * encrypted again, so that changing the key doesn't lose them.
+ * The positions are dropped when the entry is invalidated by a change
+ * of the sequence, of its options or of privileges.
+ */
+static int64
+next_preallocated_value(Oid seq_oid, const CipherContext *ctx)
+{
+	SequenceBoundsEntry *entry = get_sequence_entry(seq_oid);
+
+	if (entry->prealloc_next >= entry->prealloc_count)
+	{
+		if (entry->prealloc_size != prealloc_block_size)
+		{
+			if (entry->prealloc_positions != NULL)
+			{
+				pfree(entry->prealloc_positions);
+				pfree(entry->prealloc_values);
+			}
+			entry->prealloc_positions = (int64 *)
+				MemoryContextAlloc(TopMemoryContext,
+						   prealloc_block_size * sizeof(int64));
+			entry->prealloc_values = (int64 *)
+				MemoryContextAlloc(TopMemoryContext,
+						   prealloc_block_size * sizeof(int64));
+			entry->prealloc_size = prealloc_block_size;
+		}
+
+		entry->prealloc_count = 0;
+		entry->prealloc_next = 0;
+		entry->prealloc_encrypted = false;
+		entry->prealloc_count =
+			sequence_claim_positions(seq_oid, entry->minval, entry->maxval,
+						 entry->prealloc_size,
+						 entry->prealloc_positions);
+	}
+
+	if (!entry->prealloc_encrypted ||
+	    entry->prealloc_key != ctx->crypt_key ||
+	    entry->prealloc_opts.algorithm != ctx->opts.algorithm ||
+	    entry->prealloc_opts.rounds != ctx->opts.rounds)
+	{
+		int next = entry->prealloc_next;
+
+		cycle_walking_cipher_batch(ctx, entry->prealloc_positions + next,
+					   entry->prealloc_values + next,
+					   entry->prealloc_count - next, 0);
+		entry->prealloc_encrypted = true;
+		entry->prealloc_key = ctx->crypt_key;
+		entry->prealloc_opts = ctx->opts;
+	}
+
+	return entry->prealloc_values[entry->prealloc_next++];
+}
+
+/*
+ * Check the number of values requested from a batch function.
+ */
+static void
+check_batch_count(int64 count)
+{
+	if (count < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("number of values must not be negative")));
+	}
+}
+
+/*
+ * Maximum number of elements of the arrays of new_int8_array(), for
+ * their size to stay within the limit of palloc().
+ */
+#define MAX_INT8_ARRAY_COUNT \
+	((int64) ((MaxAllocSize - ARR_OVERHEAD_NONULLS(1)) / sizeof(int64)))
+
+/*
+ * Check that count values fit in an array of new_int8_array(), with
+ * a hint on the set-returning function to use instead.
+ */
+static void
+check_int8_array_count(int64 count, const char *srf_name)
+{
+	if (count > MAX_INT8_ARRAY_COUNT)
+	{
+		ereport(ERROR, (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				errmsg("too many values requested for an array: %"PRId64, count),
+				errdetail("A bigint[] result is limited to %"PRId64" values.",
+					  MAX_INT8_ARRAY_COUNT),
+				errhint("Use %s() to get more values as rows.", srf_name)));
+	}
+}
+
+/*
+ * Allocate a one-dimensional bigint[] array of count elements without
+ * NULLs, for count > 0, whose values are then written directly into
+ * ARR_DATA_PTR() by the cipher, instead of being boxed into Datums for
+ * construct_array(), which takes one palloc per element when bigint is
+ * passed by reference.
+ */
+static ArrayType *
+new_int8_array(int count)
+{
+	Size nbytes = ARR_OVERHEAD_NONULLS(1) + (Size) count * sizeof(int64);
+	ArrayType *result = (ArrayType *) palloc0(nbytes);
+
+	SET_VARSIZE(result, nbytes);
+	result->ndim = 1;
+	result->dataoffset = 0;
+	result->elemtype = INT8OID;
+	ARR_DIMS(result)[0] = count;
+	ARR_LBOUND(result)[0] = 1;
+
+	return result;
+}
+
+/*
+ * Number of non-NULL elements of a bigint[] array. They are stored
+ * contiguously from ARR_DATA_PTR(), since NULLs take no space, so that
+ * they can be read and written there as an array of int64.
+ */
+static int
+int8_array_count_values(ArrayType *arr)
+{
+	int nitems = ArrayGetNItems(ARR_NDIM(arr), ARR_DIMS(arr));
+	bits8 *bitmap = ARR_NULLBITMAP(arr);
+	int count = 0;
+	int i;
+
+	if (ARR_ELEMTYPE(arr) != INT8OID)
+		elog(ERROR, "expected an array of bigint");
+
+	if (bitmap == NULL)
+		return nitems;
+
+	for (i = 0; i < nitems; i++)
+	{
+		if (bitmap[i / 8] & (1 << (i % 8)))
+			count++;
+	}
+	return count;
+}
+
+/*
+ * Module load callback
+ */
+void
+_PG_init(void)
+{
+	const char *impl = select_feistel_rounds();
+
+	elog(DEBUG1, "permuteseq: using the %s implementation of the Feistel rounds",
+	     impl);
+
+	DefineCustomIntVariable("permuteseq.prealloc_block_size",
+				"Number of positions of a sequence claimed at once by permute_nextval() and permuteseq_nextval().",
+				"The positions are encrypted ahead of time and returned by the next calls in the session. "
+				"This leaves gaps in the permuted values: positions not returned when the session ends "
+				"are lost, and positions left when this is set to 0 are only returned if it's set again. "
+				"0 disables preallocation.",
+				&prealloc_block_size,
+				0, 0, 1000000,
+				PGC_USERSET, 0,
+				NULL, NULL, NULL);
+
+	DefineCustomIntVariable("permuteseq.lookup_table_threshold",
+				"Maximum size of a range for which the permutation is precomputed.",
+				"The permutation of a range and its inverse are computed into tables "
+				"kept in a small per-session cache when a range and key are used twice. "
+				"0 disables the tables.",
+				&lookup_table_threshold,
+				65536, 0, 1 << 20,
+				PGC_USERSET, 0,
+				NULL, NULL, NULL);
+
+	DefineCustomIntVariable("permuteseq.shared_cache_size",
+				"Number of cipher contexts kept in shared memory.",
+				"The contexts set up for a range, key and options are shared "
+				"by all the sessions when the library is in shared_preload_libraries. "
+				"0 disables the cache.",
+				&shared_cache_size,
+				1024, 0, 65536,
+				PGC_POSTMASTER, 0,
+				NULL, NULL, NULL);
+
+#if PG_VERSION_NUM >= 150000
+	MarkGUCPrefixReserved("permuteseq");
+#else
+	EmitWarningsOnPlaceholders("permuteseq");
+#endif
+
+	/* The statistics are only shared when preloaded, otherwise
+	   each backend has only its own. */
+	if (process_shared_preload_libraries_in_progress)
+	{
+#if PG_VERSION_NUM >= 150000
+		prev_shmem_request_hook = shmem_request_hook;
+		shmem_request_hook = permuteseq_shmem_request;
+#else
+		RequestAddinShmemSpace(permuteseq_shmem_size());
+#endif
+		prev_shmem_startup_hook = shmem_startup_hook;
+		shmem_startup_hook = permuteseq_shmem_startup;
+	}
+
+	RegisterXactCallback(permuteseq_xact_callback, NULL);
+}
+
+static Size
+permuteseq_shmem_size(void)
+{
+	return add_size(MAXALIGN(sizeof(PermuteseqSharedStats)),
+			mul_size(shared_cache_size, sizeof(SharedCipherSlot)));
+}
+
+#if PG_VERSION_NUM >= 150000
+static void
+permuteseq_shmem_request(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(permuteseq_shmem_size());
+}
+#endif
+
+static void
+permuteseq_shmem_startup(void)
+{
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	shared_stats = ShmemInitStruct("permuteseq stats",
+				       sizeof(PermuteseqSharedStats), &found);
+	if (!found)
+	{
+		SpinLockInit(&shared_stats->mutex);
+		memset(&shared_stats->stats, 0, sizeof(PermuteseqStats));
+		shared_stats->stats_reset = GetCurrentTimestamp();
+	}
+	if (shared_cache_size > 0)
+	{
+		shared_ciphers = ShmemInitStruct("permuteseq cipher cache",
+						 mul_size(shared_cache_size, sizeof(SharedCipherSlot)),
+						 &found);
+		if (!found)
+		{
+			int i;
+
+			for (i = 0; i < shared_cache_size; i++)
+				pg_atomic_init_u32(&shared_ciphers[i].changecount, 0);
+		}
+	}
+	LWLockRelease(AddinShmemInitLock);
+}
+
+static void
+add_stats(PermuteseqStats *to, const PermuteseqStats *from)
+{
+	to->calls += from->calls;
+	to->walks += from->walks;
+	to->max_walks = Max(to->max_walks, from->max_walks);
+	to->table_lookups += from->table_lookups;
+	to->table_builds += from->table_builds;
+	to->context_hits += from->context_hits;
+	to->context_misses += from->context_misses;
+	to->bounds_hits += from->bounds_hits;
+	to->bounds_misses += from->bounds_misses;
+	to->shared_hits += from->shared_hits;
+	to->shared_misses += from->shared_misses;
+}
+
+/*
+ * Add the counters of the backend to the shared statistics, if any,
+ * and reset them.
+ */
+static void
+flush_local_stats(void)
+{
+	PermuteseqStats *local = &permuteseq_local_stats;
+
+	if (shared_stats == NULL ||
+	    (local->calls == 0 && local->context_hits == 0 && local->context_misses == 0 &&
+	     local->bounds_hits == 0 && local->bounds_misses == 0 &&
+	     local->shared_hits == 0 && local->shared_misses == 0))
+		return;
+
+	SpinLockAcquire(&shared_stats->mutex);
+	add_stats(&shared_stats->stats, local);
+	SpinLockRelease(&shared_stats->mutex);
+
+	memset(local, 0, sizeof(PermuteseqStats));
+}
+
+/*
+ * Flush the statistics at the end of each transaction, so that the
+ * counters are only updated locally in the hot paths.
+ */
+static void
+permuteseq_xact_callback(XactEvent event, void *arg)
+{
+	switch (event)
+	{
+		case XACT_EVENT_COMMIT:
+		case XACT_EVENT_ABORT:
+		case XACT_EVENT_PARALLEL_COMMIT:
+		case XACT_EVENT_PARALLEL_ABORT:
+			flush_local_stats();
+			break;
+		default:
+			break;
+	}
+}
+
+PG_FUNCTION_INFO_V1(permute_nextval);
+
+
+/*
+ * Input: a sequence (through its OID) and a 64-bit encryption key.
+ * Take the nextval (64-bit integer) and return its associated
+ * unique value in the pseudo-random permutation resulting from
+ * encrypting the sequence.
+ * The output is constrained to the boundaries of the sequence by
+ * using a cycle-walking cipher on top of a Feistel network.
+ */
+Datum
+permute_nextval(PG_FUNCTION_ARGS)
+{
+	Oid seq_oid = PG_GETARG_OID(0);
+	uint64 crypt_key = PG_GETARG_INT64(1);
+	int64 minval, maxval, nextval;
+	CipherOptions opts;
+	CipherContext *ctx;
+
+	get_encryptable_sequence_range(seq_oid, &minval, &maxval, &opts);
+
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+
+	if (prealloc_block_size > 0)
+		PG_RETURN_INT64(next_preallocated_value(seq_oid, ctx));
+
+	nextval = sequence_next_position(seq_oid, minval, maxval, true);
+
+	PG_RETURN_INT64(cycle_walking_cipher(ctx, nextval, 0));
+}
+
+PG_FUNCTION_INFO_V1(permute_nextval_batch);
+
+/*
+ * Set-returning version of permute_nextval().
+ * Input: a sequence OID, a 64-bit encryption key and a number of values.
+ * Advance the sequence that number of times and return the
+ * permuted values, one per row.
+ * The sequence bounds and the cipher are set up only once for
+ * all the values.
+ */
+Datum
+permute_nextval_batch(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	CipherContext *ctx;
+	Oid seq_oid;
+	int64 nextval;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		uint64 crypt_key = PG_GETARG_INT64(1);
+		int64 count = PG_GETARG_INT64(2);
+		int64 minval, maxval;
+		CipherOptions opts;
+
+		check_batch_count(count);
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		seq_oid = PG_GETARG_OID(0);
+		get_encryptable_sequence_range(seq_oid, &minval, &maxval, &opts);
+
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+		ctx = (CipherContext *) palloc(sizeof(CipherContext));
+		cipher_init(ctx, minval, maxval, crypt_key, &opts);
+		MemoryContextSwitchTo(oldcontext);
+
+		funcctx->user_fctx = ctx;
+		funcctx->max_calls = count;
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	ctx = (CipherContext *) funcctx->user_fctx;
+	seq_oid = PG_GETARG_OID(0);
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		nextval = sequence_next_position(seq_oid, ctx->minval, ctx->maxval,
+						 funcctx->call_cntr == 0);
+		SRF_RETURN_NEXT(funcctx,
+				Int64GetDatum(cycle_walking_cipher(ctx, nextval, 0)));
+	}
+	else
+		SRF_RETURN_DONE(funcctx);
+}
+
+PG_FUNCTION_INFO_V1(permute_nextval_array);
+
+/*
+ * Same as permute_nextval_batch(), except that the permuted values
+ * are returned in a bigint[] array, in the order of the sequence.
+ */
+Datum
+permute_nextval_array(PG_FUNCTION_ARGS)
+{
+	Oid seq_oid = PG_GETARG_OID(0);
+	uint64 crypt_key = PG_GETARG_INT64(1);
+	int64 count = PG_GETARG_INT64(2);
+	int64 minval, maxval;
+	CipherOptions opts;
+	CipherContext ctx;
+	ArrayType *result;
+	int64 *values;
+	int64 base, i;
+
+	check_batch_count(count);
+	check_int8_array_count(count, "permute_nextval_batch");
+
+	get_encryptable_sequence_range(seq_oid, &minval, &maxval, &opts);
+	cipher_init(&ctx, minval, maxval, crypt_key, &opts);
+
+	if (count == 0)
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT8OID));
+
+	/* The positions are claimed and encrypted in place in the result,
+	   CIPHER_CHUNK at a time. */
+	result = new_int8_array((int) count);
+	values = (int64 *) ARR_DATA_PTR(result);
+	for (base = 0; base < count; base += CIPHER_CHUNK)
+	{
+		int n = (int) Min(CIPHER_CHUNK, count - base);
+
+		CHECK_FOR_INTERRUPTS();
+		for (i = base; i < base + n; i++)
+			values[i] = sequence_next_position(seq_oid, minval, maxval, i == 0);
+		cycle_walking_cipher_batch(&ctx, values + base, values + base, n, 0);
+	}
+
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
+/*
+ * Get the bounds and options of a sequence whose values are decrypted
+ * by the reverse_permute*() functions.
+ */
+static void
+get_reversible_sequence_range(Oid seq_oid, int64 *minval, int64 *maxval,
+			      CipherOptions *opts)
+{
+	get_sequence_min_max(seq_oid, minval, maxval, opts);
+
+	/* the same condition as for the encryption, so that all the values
+	   produced can be decrypted */
+	if (!check_sequence_range(*minval, *maxval))
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("sequence too short to decrypt."),
+				errhint("The difference between minimum and maximum values should be at least 3.")));
+	}
+}
+
+/*
+ * Decrypt in place the non-NULL elements of arr, a bigint[] array
+ * that the caller may modify, with the cipher of a sequence,
+ * checking that they are inside its bounds.
+ */
+static void
+reverse_permute_elements(ArrayType *arr, const CipherContext *ctx)
+{
+	int nvalues = int8_array_count_values(arr);
+	int64 *values = (int64 *) ARR_DATA_PTR(arr);
+	int i;
+
+	for (i = 0; i < nvalues; i++)
+	{
+		if (values[i] < ctx->minval || values[i] > ctx->maxval)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("value out of sequence bounds.")));
+		}
+	}
+
+	cycle_walking_cipher_batch(ctx, values, values, nvalues, 1);
+}
+
+PG_FUNCTION_INFO_V1(reverse_permute);
+
+/*
+ * Input: a sequence OID, a 64-bit value previously produced by permute_nextval(),
+ * and the encryption key
+ * Output: the original value of the sequence element
+ * The sequence is used to obtain the minval and maxval for the
+ * Feistel Network block size and the cycle walking algorithm.
+ */
+Datum
+reverse_permute(PG_FUNCTION_ARGS)
+{
+	Oid seq_oid = PG_GETARG_OID(0);
+	int64 value = PG_GETARG_INT64(1);
+	uint64 crypt_key = PG_GETARG_INT64(2);
+	int64 minval, maxval;
+	CipherOptions opts;
+	CipherContext *ctx;
+
+	get_reversible_sequence_range(seq_oid, &minval, &maxval, &opts);
+
+	if (value < minval || value > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("value out of sequence bounds.")));
+	}
+
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+
+	PG_RETURN_INT64(cycle_walking_cipher(ctx, value, 1));
+}
+
+PG_FUNCTION_INFO_V1(reverse_permute_array);
+
+/*
+ * Same as reverse_permute() for all the elements of a bigint[] array,
+ * with the sequence looked up and the cipher set up once.
+ * The result has the same dimensions as the input, with the NULL
+ * elements left in place.
+ */
+Datum
+reverse_permute_array(PG_FUNCTION_ARGS)
+{
+	Oid seq_oid = PG_GETARG_OID(0);
+	ArrayType *arr = PG_GETARG_ARRAYTYPE_P_COPY(1);
+	uint64 crypt_key = PG_GETARG_INT64(2);
+	int64 minval, maxval;
+	CipherOptions opts;
+	CipherContext *ctx;
+
+	get_reversible_sequence_range(seq_oid, &minval, &maxval, &opts);
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+
+	/* the copy of the input is the result */
+	reverse_permute_elements(arr, ctx);
+
+	PG_RETURN_ARRAYTYPE_P(arr);
+}
+
+/*
+ * State of reverse_permute_rows() across calls: the non-NULL input
+ * values and their decrypted values, in the data of the input array
+ * and of a copy of it.
+ */
+typedef struct ReversePermuteRowsState
+{
+	const int64 *values;
+	const int64 *clear_values;
+	int			nvalues;
+	int			next;
+} ReversePermuteRowsState;
+
+PG_FUNCTION_INFO_V1(reverse_permute_rows);
+
+/*
+ * Return the rows (value, clear_val) of the non-null elements of a
+ * bigint[] array of values, in the order of the array, clear_val
+ * being reverse_permute(seq_oid, value, crypt_key).
+ * It's meant to be joined to the rows whose values are aggregated
+ * into the array, decrypting them all at once.
+ */
+Datum
+reverse_permute_rows(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	ReversePermuteRowsState *state;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		Oid seq_oid = PG_GETARG_OID(0);
+		ArrayType *arr;
+		ArrayType *clear_arr;
+		uint64 crypt_key = PG_GETARG_INT64(2);
+		int64 minval, maxval;
+		CipherOptions opts;
+		CipherContext ctx;
+		TupleDesc tupdesc;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		get_reversible_sequence_range(seq_oid, &minval, &maxval, &opts);
+		cipher_init(&ctx, minval, maxval, crypt_key, &opts);
+
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		arr = PG_GETARG_ARRAYTYPE_P_COPY(1);
+		clear_arr = (ArrayType *) palloc(VARSIZE(arr));
+		memcpy(clear_arr, arr, VARSIZE(arr));
+		reverse_permute_elements(clear_arr, &ctx);
+
+		state = (ReversePermuteRowsState *) palloc(sizeof(ReversePermuteRowsState));
+		state->values = (const int64 *) ARR_DATA_PTR(arr);
+		state->clear_values = (const int64 *) ARR_DATA_PTR(clear_arr);
+		state->nvalues = int8_array_count_values(arr);
+		state->next = 0;
+
+		MemoryContextSwitchTo(oldcontext);
+
+		funcctx->user_fctx = state;
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	state = (ReversePermuteRowsState *) funcctx->user_fctx;
+
+	if (state->next < state->nvalues)
+	{
+		Datum values[2];
+		bool nulls[2] = {false, false};
+		HeapTuple tuple;
+
+		values[0] = Int64GetDatum(state->values[state->next]);
+		values[1] = Int64GetDatum(state->clear_values[state->next]);
+		state->next++;
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+	else
+		SRF_RETURN_DONE(funcctx);
+}
+
+PG_FUNCTION_INFO_V1(range_encrypt_element);
+
+/*
+ * Direct interface to cycle_walking_cipher to encrypt/permute a value
+ * from [minval,maxval] into itself, without a database sequence.
+ */
+Datum
+range_encrypt_element(PG_FUNCTION_ARGS)
+{
+	int64 clearval = PG_GETARG_INT64(0);
+	int64 minval = PG_GETARG_INT64(1);
+	int64 maxval = PG_GETARG_INT64(2);
+	uint64 crypt_key = PG_GETARG_INT64(3);
+	CipherOptions opts;
+	CipherContext *ctx;
+
+	get_cipher_options_args(fcinfo, 4, &opts);
+
+	if (clearval < minval || clearval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid value: %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
+				       clearval, minval, maxval)));
+	}
+
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+
+	PG_RETURN_INT64(cycle_walking_cipher(ctx, clearval, 0));
+}
+
+PG_FUNCTION_INFO_V1(range_decrypt_element);
+
+/*
+ * Direct interface to cycle_walking_cipher to decrypt/permute a value
+ * from [minval,maxval] into itself, without a database sequence.
+ */
+Datum
+range_decrypt_element(PG_FUNCTION_ARGS)
+{
+	int64 val = PG_GETARG_INT64(0);
+	int64 minval = PG_GETARG_INT64(1);
+	int64 maxval = PG_GETARG_INT64(2);
+	uint64 crypt_key = PG_GETARG_INT64(3);
+	CipherOptions opts;
+	CipherContext *ctx;
+
+	get_cipher_options_args(fcinfo, 4, &opts);
+
+	if (val < minval || val > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid value: %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
+				       val, minval, maxval)));
+	}
+
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+
+	PG_RETURN_INT64(cycle_walking_cipher(ctx, val, 1));
+}
+
+
+/*
+ * Encrypt a position of the sequence as permute_nextval() would, without
+ * advancing the sequence, with the cipher cached for fcinfo.
+ */
+static int64
+permute_position_internal(FunctionCallInfo fcinfo, Oid seq_oid, int64 clearval,
+			  uint64 crypt_key)
+{
+	int64 minval, maxval;
+	CipherOptions opts;
+	CipherContext *ctx;
+
+	get_encryptable_sequence_range(seq_oid, &minval, &maxval, &opts);
+
+	if (clearval < minval || clearval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("value out of sequence bounds.")));
+	}
+
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+
+	return cycle_walking_cipher(ctx, clearval, 0);
+}
+
+PG_FUNCTION_INFO_V1(permute_position);
+
+/*
+ * SQL interface to permute_position_internal(), the inverse of
+ * reverse_permute().
+ */
+Datum
+permute_position(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_INT64(permute_position_internal(fcinfo, PG_GETARG_OID(0),
+						  PG_GETARG_INT64(1),
+						  PG_GETARG_INT64(2)));
+}
+
+PG_FUNCTION_INFO_V1(reverse_permutes_to);
+
+/*
+ * Return true if value is in the bounds of the sequence and
+ * reverse_permute() of value is clearval.
+ * The planner rewrites calls into value = permute_position(...), so that
+ * an index on value can be used (see permuteseq_support()). When
+ * evaluated as is, value is compared to the encrypted clearval too, so that
+ * both forms have the same results and errors.
+ */
+Datum
+reverse_permutes_to(PG_FUNCTION_ARGS)
+{
+	int64 value = PG_GETARG_INT64(1);
+
+	PG_RETURN_BOOL(value == permute_position_internal(fcinfo, PG_GETARG_OID(0),
+							  PG_GETARG_INT64(3),
+							  PG_GETARG_INT64(2)));
+}
+
+PG_FUNCTION_INFO_V1(range_decrypts_to);
+
+/*
+ * Return true if cryptval is in [minval,maxval] and
+ * range_decrypt_element() of cryptval is clearval.
+ * Like reverse_permutes_to(), it's rewritten by the planner into
+ * cryptval = range_encrypt_element(clearval, ...), or a constant
+ * when the other arguments are constants.
+ */
+Datum
+range_decrypts_to(PG_FUNCTION_ARGS)
+{
+	int64 cryptval = PG_GETARG_INT64(0);
+	int64 minval = PG_GETARG_INT64(1);
+	int64 maxval = PG_GETARG_INT64(2);
+	uint64 crypt_key = PG_GETARG_INT64(3);
+	int64 clearval = PG_GETARG_INT64(4);
+	CipherOptions opts;
+	CipherContext *ctx;
+
+	get_cipher_options_args(fcinfo, 5, &opts);
+
+	if (clearval < minval || clearval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid value: %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
+				       clearval, minval, maxval)));
+	}
+
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+
+	PG_RETURN_BOOL(cryptval == cycle_walking_cipher(ctx, clearval, 0));
+}
+
+#if PG_VERSION_NUM >= 120000
+/*
+ * Return the OID of a function of the extension with the given arguments.
+ */
+static Oid
+lookup_extension_function(const char *name, int nargs, const Oid *argtypes)
+{
+	Oid ext_oid = get_extension_oid("permuteseq", false);
+	char *schema = get_namespace_name(get_extension_schema(ext_oid));
+
+	if (schema == NULL)
+		elog(ERROR, "could not find the schema of extension permuteseq");
+
+	return LookupFuncName(list_make2(makeString(schema), makeString(pstrdup(name))),
+			      nargs, argtypes, false);
+}
+
+/*
+ * Return the equality of two int8 expressions.
+ */
+static Node *
+make_int8_equality(Expr *left, Expr *right)
+{
+	OpExpr *op = (OpExpr *) make_opclause(Int8EqualOperator, BOOLOID, false,
+					      left, right, InvalidOid, InvalidOid);
+
+	set_opfuncid(op);
+	return (Node *) op;
+}
+#endif
+
+PG_FUNCTION_INFO_V1(permuteseq_support);
+
+/*
+ * Planner support function of reverse_permutes_to() and
+ * range_decrypts_to().
+ * A condition on a decrypted value like reverse_permute(seq, id, key) = 42
+ * can't use an index on id, and a support function of reverse_permute()
+ * wouldn't see the comparison. But since the permutation is a bijection,
+ * reverse_permutes_to(seq, id, key, 42) is the same as
+ * id = permute_position(seq, 42, key), in which the right side doesn't
+ * depend on the row, so this is the expression that the calls are
+ * simplified into. For range_decrypts_to(), the encryption is done by the
+ * planner when its arguments are constants.
+ * Only equality can be handled this way, since the permutation doesn't
+ * preserve the order of the values.
+ */
+Datum
+permuteseq_support(PG_FUNCTION_ARGS)
+{
+	Node *ret = NULL;
+#if PG_VERSION_NUM >= 120000
+	Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+
+	if (IsA(rawreq, SupportRequestSimplify))
+	{
+		SupportRequestSimplify *req = (SupportRequestSimplify *) rawreq;
+		List *args = req->fcall->args;
+
+		if (list_length(args) == 4)
+		{
+			/* reverse_permutes_to(seq, value, key, clearval) */
+			Oid argtypes[3] = {OIDOID, INT8OID, INT8OID};
+			Oid funcid = lookup_extension_function("permute_position", 3, argtypes);
+			Expr *encrypted;
+
+			encrypted = (Expr *) makeFuncExpr(funcid, INT8OID,
+							  list_make3(linitial(args),
+								     lfourth(args),
+								     lthird(args)),
+							  InvalidOid, InvalidOid,
+							  COERCE_EXPLICIT_CALL);
+			ret = make_int8_equality((Expr *) lsecond(args), encrypted);
+		}
+		else if (list_length(args) >= 5)
+		{
+			/* range_decrypts_to(cryptval, min, max, key, clearval
+			   [, algorithm, rounds]) */
+			ListCell *lc;
+			bool all_consts = true;
+			Expr *encrypted;
+			int i = 0;
+
+			foreach(lc, args)
+			{
+				if (i++ > 0 &&
+				    (!IsA(lfirst(lc), Const) || ((Const *) lfirst(lc))->constisnull))
+					all_consts = false;
+			}
+
+			if (all_consts)
+			{
+				int64 minval = DatumGetInt64(((Const *) lsecond(args))->constvalue);
+				int64 maxval = DatumGetInt64(((Const *) lthird(args))->constvalue);
+				uint64 crypt_key = DatumGetInt64(((Const *) lfourth(args))->constvalue);
+				int64 clearval = DatumGetInt64(((Const *) list_nth(args, 4))->constvalue);
+				CipherOptions opts;
+				CipherContext ctx;
+
+				opts.algorithm = (list_length(args) > 5) ?
+					DatumGetInt32(((Const *) list_nth(args, 5))->constvalue) :
+					PERMUTESEQ_ALGO_DEFAULT;
+				opts.rounds = (list_length(args) > 6) ?
+					DatumGetInt32(((Const *) list_nth(args, 6))->constvalue) :
+					PERMUTESEQ_DEFAULT_ROUNDS;
+
+				/* leave invalid arguments to the error at execution */
+				if (clearval < minval || clearval > maxval ||
+				    !check_sequence_range(minval, maxval))
+					PG_RETURN_POINTER(NULL);
+				check_cipher_options(&opts);
+
+				cipher_init(&ctx, minval, maxval, crypt_key, &opts);
+				encrypted = (Expr *) makeConst(INT8OID, -1, InvalidOid, sizeof(int64),
+							       Int64GetDatum(cycle_walking_cipher(&ctx, clearval, 0)),
+							       false, FLOAT8PASSBYVAL);
+			}
+			else
+			{
+				Oid argtypes[6] = {INT8OID, INT8OID, INT8OID, INT8OID, INT4OID, INT4OID};
+				List *encrypt_args = list_make4(list_nth(args, 4), lsecond(args),
+								lthird(args), lfourth(args));
+				Oid funcid;
+
+				/* range_encrypt_element(clearval, min, max, key
+				   [, algorithm, rounds]) */
+				i = 0;
+				foreach(lc, args)
+				{
+					if (i++ >= 5)
+						encrypt_args = lappend(encrypt_args, lfirst(lc));
+				}
+
+				funcid = lookup_extension_function("range_encrypt_element",
+								   list_length(encrypt_args), argtypes);
+				encrypted = (Expr *) makeFuncExpr(funcid, INT8OID, encrypt_args,
+								  InvalidOid, InvalidOid,
+								  COERCE_EXPLICIT_CALL);
+			}
+			ret = make_int8_equality((Expr *) linitial(args), encrypted);
+		}
+	}
+#endif
+
+	PG_RETURN_POINTER(ret);
+}
+
+/*
+ * Common code for range_encrypt_array() and range_decrypt_array().
+ * The non-null elements are gathered and passed together to the
+ * cipher. The result has the same dimensions as the input, with the
+ * NULL elements left in place.
+ */
+static Datum
+range_crypt_array(FunctionCallInfo fcinfo, int direction)
+{
+	ArrayType *arr = PG_GETARG_ARRAYTYPE_P_COPY(0);
+	int64 minval = PG_GETARG_INT64(1);
+	int64 maxval = PG_GETARG_INT64(2);
+	uint64 crypt_key = PG_GETARG_INT64(3);
+	CipherOptions opts;
+	CipherContext *ctx;
+	int nvalues, base, i;
+	int64 *values;
+
+	get_cipher_options_args(fcinfo, 4, &opts);
+
+	/* The copy of the input is the result, its values being encrypted
+	   in place, CIPHER_CHUNK at a time. */
+	nvalues = int8_array_count_values(arr);
+	if (nvalues == 0)
+		PG_RETURN_ARRAYTYPE_P(arr);
+	values = (int64 *) ARR_DATA_PTR(arr);
+
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+
+	for (base = 0; base < nvalues; base += CIPHER_CHUNK)
+	{
+		int n = Min(CIPHER_CHUNK, nvalues - base);
+
+		for (i = base; i < base + n; i++)
+		{
+			if (values[i] < minval || values[i] > maxval)
+			{
+				ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						errmsg("invalid value: %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
+						       values[i], minval, maxval)));
+			}
+		}
+		cycle_walking_cipher_batch(ctx, values + base, values + base, n, direction);
+	}
+
+	PG_RETURN_ARRAYTYPE_P(arr);
+}
+
+PG_FUNCTION_INFO_V1(range_encrypt_array);
+
+/*
+ * Encrypt all the elements of a bigint[] array within the [minval,maxval]
+ * range, as range_encrypt_element() would do for each element.
+ */
+Datum
+range_encrypt_array(PG_FUNCTION_ARGS)
+{
+	return range_crypt_array(fcinfo, 0);
+}
+
+PG_FUNCTION_INFO_V1(range_decrypt_array);
+
+/*
+ * Decrypt all the elements of a bigint[] array previously encrypted
+ * with range_encrypt_array() or range_encrypt_element().
+ */
+Datum
+range_decrypt_array(PG_FUNCTION_ARGS)
+{
+	return range_crypt_array(fcinfo, 1);
+}
+
+
+/*
+ * Key-versioned permutations.
+ * With n keys, the values of [minval,maxval] are split into n classes
+ * by their offset modulo n. The first slot_size = floor(size/n) values of
+ * the interval are permuted with the key of version v into the
+ * offsets of the class v: the offset e of the encryption with that key
+ * of the values of [minval,minval+slot_size-1] becomes e*n+v.
+ * The version of an encrypted value is then its offset modulo n, and
+ * it's decrypted with a single pass of the cipher with the right key.
+ * A key is replaced by changing its element in the array of keys, all
+ * other versions staying decryptable. With a single key, the results
+ * are the same as with the functions taking a single key, over the whole
+ * range, including the full int64 range whose size doesn't fit in 64 bits.
+ */
+#define PERMUTESEQ_MAX_KEY_VERSIONS	256
+
+typedef struct VersionedCipher
+{
+	int64		minval;
+	int64		maxval;
+	CipherOptions	opts;
+	uint64		slot_max;	/* last offset permuted by each key, i.e. the
+					 * number of values per key minus 1, which
+					 * fits even with a key for the full range */
+	int			nkeys;
+	int			allocated;	/* size of the ctx array */
+	CipherContext ctx[FLEXIBLE_ARRAY_MEMBER];	/* cipher of each version */
+} VersionedCipher;
+
+/*
+ * Return the versioned cipher cached in fn_extra for the range, the
+ * array of keys and the options, setting it up if necessary.
+ */
+static VersionedCipher *
+get_cached_versioned_cipher(FunctionCallInfo fcinfo, int64 minval, int64 maxval,
+			    ArrayType *keys_arr, const CipherOptions *opts)
+{
+	VersionedCipher *vc = (VersionedCipher *) fcinfo->flinfo->fn_extra;
+	Datum *keys;
+	bool *nulls;
+	int nkeys, i;
+	uint64 max_offset = (uint64) maxval - (uint64) minval;
+	bool same;
+
+	if (ARR_ELEMTYPE(keys_arr) != INT8OID)
+		elog(ERROR, "expected an array of bigint");
+
+	deconstruct_array(keys_arr, INT8OID, sizeof(int64), FLOAT8PASSBYVAL, 'd',
+			  &keys, &nulls, &nkeys);
+
+	if (nkeys < 1 || nkeys > PERMUTESEQ_MAX_KEY_VERSIONS)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("the number of keys must be between 1 and %d",
+				       PERMUTESEQ_MAX_KEY_VERSIONS)));
+	}
+	for (i = 0; i < nkeys; i++)
+	{
+		if (nulls[i])
+			ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					errmsg("the array of keys must not contain nulls")));
+	}
+
+	same = (vc != NULL && vc->nkeys == nkeys &&
+		vc->minval == minval && vc->maxval == maxval &&
+		vc->opts.algorithm == opts->algorithm &&
+		vc->opts.rounds == opts->rounds);
+	for (i = 0; same && i < nkeys; i++)
+		same = (vc->ctx[i].crypt_key == (uint64) DatumGetInt64(keys[i]));
+
+	if (!same)
+	{
+		uint64 slot_max;
+
+		/* A single key permutes the whole range, as the functions
+		   taking a single key do */
+		if (nkeys == 1)
+			slot_max = max_offset;
+		else
+		{
+			/* floor((max_offset+1)/nkeys), max_offset+1 overflowing for
+			   the full int64 range */
+			uint64 slot_size = max_offset / nkeys +
+				((max_offset % nkeys) == (uint64) (nkeys - 1));
+
+			slot_max = (slot_size > 0) ? slot_size - 1 : 0;
+		}
+		if (slot_max < 3)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					errmsg("range [%"PRId64",%"PRId64"] too short for %d key versions",
+					       minval, maxval, nkeys),
+					errhint("The range should contain at least 4 values per key.")));
+		}
+
+		if (vc == NULL || vc->allocated < nkeys)
+		{
+			if (vc != NULL)
+				pfree(vc);
+			vc = (VersionedCipher *) MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+								    offsetof(VersionedCipher, ctx) +
+								    nkeys * sizeof(CipherContext));
+			vc->allocated = nkeys;
+			fcinfo->flinfo->fn_extra = vc;
+		}
+
+		vc->minval = minval;
+		vc->maxval = maxval;
+		vc->opts = *opts;
+		vc->slot_max = slot_max;
+		vc->nkeys = nkeys;
+		for (i = 0; i < nkeys; i++)
+		{
+			cipher_init_shared(&vc->ctx[i], minval,
+					   (int64) ((uint64) minval + slot_max),
+					   (uint64) DatumGetInt64(keys[i]), opts);
+		}
+		permuteseq_local_stats.context_misses++;
+	}
+	else
+		permuteseq_local_stats.context_hits++;
+
+	pfree(keys);
+	pfree(nulls);
+
+	return vc;
+}
+
+/*
+ * Encrypt a value of [minval,minval+slot_max] with the key of version.
+ */
+static int64
+versioned_encrypt(const VersionedCipher *vc, int64 value, int version)
+{
+	uint64 e;
+
+	if (version < 0 || version >= vc->nkeys)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("key version %d out of range [0,%d]",
+				       version, vc->nkeys - 1)));
+	}
+	if (value < vc->minval || (uint64) value - (uint64) vc->minval > vc->slot_max)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid value: %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
+				       value, vc->minval,
+				       (int64) ((uint64) vc->minval + vc->slot_max)),
+				errdetail("With %d key versions, only the first %"PRIu64" values of the range can be encrypted.",
+					  vc->nkeys, vc->slot_max + 1)));
+	}
+
+	e = (uint64) cipher_encrypt(&vc->ctx[version], value) - (uint64) vc->minval;
+
+	return (int64) ((uint64) vc->minval + e * vc->nkeys + version);
+}
+
+/*
+ * Decrypt a value produced by versioned_encrypt(), with the key of its
+ * version.
+ */
+static int64
+versioned_decrypt(const VersionedCipher *vc, int64 value)
+{
+	uint64 offset;
+	uint64 e;
+
+	if (value < vc->minval || value > vc->maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid value: %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
+				       value, vc->minval, vc->maxval)));
+	}
+
+	offset = (uint64) value - (uint64) vc->minval;
+	e = offset / vc->nkeys;
+	if (e > vc->slot_max)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("value %"PRId64" was not encrypted with %d key versions",
+				       value, vc->nkeys)));
+	}
+
+	return cipher_decrypt(&vc->ctx[offset % vc->nkeys],
+			      (int64) ((uint64) vc->minval + e));
+}
+
+PG_FUNCTION_INFO_V1(range_encrypt_versioned);
+
+/*
+ * Encrypt a value within [minval,maxval] with the key of the given
+ * version (index from 0 into the array of keys).
+ */
+Datum
+range_encrypt_versioned(PG_FUNCTION_ARGS)
+{
+	int64 clearval = PG_GETARG_INT64(0);
+	int64 minval = PG_GETARG_INT64(1);
+	int64 maxval = PG_GETARG_INT64(2);
+	ArrayType *keys = PG_GETARG_ARRAYTYPE_P(3);
+	int32 version = PG_GETARG_INT32(4);
+	CipherOptions opts;
+	VersionedCipher *vc;
+
+	get_cipher_options_args(fcinfo, 5, &opts);
+
+	if (minval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid range [%"PRId64",%"PRId64"]", minval, maxval)));
+	}
+
+	vc = get_cached_versioned_cipher(fcinfo, minval, maxval, keys, &opts);
+
+	PG_RETURN_INT64(versioned_encrypt(vc, clearval, version));
+}
+
+PG_FUNCTION_INFO_V1(range_decrypt_versioned);
+
+/*
+ * Decrypt a value produced by range_encrypt_versioned() with the same
+ * array of keys, whichever the version used to encrypt it.
+ */
+Datum
+range_decrypt_versioned(PG_FUNCTION_ARGS)
+{
+	int64 cryptval = PG_GETARG_INT64(0);
+	int64 minval = PG_GETARG_INT64(1);
+	int64 maxval = PG_GETARG_INT64(2);
+	ArrayType *keys = PG_GETARG_ARRAYTYPE_P(3);
+	CipherOptions opts;
+	VersionedCipher *vc;
+
+	get_cipher_options_args(fcinfo, 4, &opts);
+
+	if (minval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid range [%"PRId64",%"PRId64"]", minval, maxval)));
+	}
+
+	vc = get_cached_versioned_cipher(fcinfo, minval, maxval, keys, &opts);
+
+	PG_RETURN_INT64(versioned_decrypt(vc, cryptval));
+}
+
+PG_FUNCTION_INFO_V1(range_key_version);
+
+/*
+ * Return the version of the key with which a value of [minval,maxval]
+ * has been encrypted with a number of key versions, without decrypting it.
+ */
+Datum
+range_key_version(PG_FUNCTION_ARGS)
+{
+	int64 cryptval = PG_GETARG_INT64(0);
+	int64 minval = PG_GETARG_INT64(1);
+	int64 maxval = PG_GETARG_INT64(2);
+	int32 nkeys = PG_GETARG_INT32(3);
+
+	if (nkeys < 1 || nkeys > PERMUTESEQ_MAX_KEY_VERSIONS)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("the number of keys must be between 1 and %d",
+				       PERMUTESEQ_MAX_KEY_VERSIONS)));
+	}
+	if (cryptval < minval || cryptval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid value: %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
+				       cryptval, minval, maxval)));
+	}
+
+	PG_RETURN_INT32((int32) (((uint64) cryptval - (uint64) minval) % nkeys));
+}
+
+PG_FUNCTION_INFO_V1(permute_nextval_versioned);
+
+/*
+ * Same as permute_nextval() with the key of the given version of an
+ * array of keys. The sequence can produce only floor(size/n) values with
+ * n keys, its range being split between the versions.
+ */
+Datum
+permute_nextval_versioned(PG_FUNCTION_ARGS)
+{
+	Oid seq_oid = PG_GETARG_OID(0);
+	ArrayType *keys = PG_GETARG_ARRAYTYPE_P(1);
+	int32 version = PG_GETARG_INT32(2);
+	int64 minval, maxval, nextval;
+	CipherOptions opts;
+	VersionedCipher *vc;
+
+	get_encryptable_sequence_range(seq_oid, &minval, &maxval, &opts);
+
+	vc = get_cached_versioned_cipher(fcinfo, minval, maxval, keys, &opts);
+
+	nextval = sequence_next_position(seq_oid, minval, maxval, true);
+	if ((uint64) nextval - (uint64) minval > vc->slot_max)
+	{
+		ereport(ERROR, (errcode(ERRCODE_SEQUENCE_GENERATOR_LIMIT_EXCEEDED),
+				errmsg("sequence %s has no more values for %d key versions",
+				       get_rel_name(seq_oid), vc->nkeys),
+				errdetail("With %d key versions, the sequence can produce %"PRIu64" values.",
+					  vc->nkeys, vc->slot_max + 1)));
+	}
+
+	PG_RETURN_INT64(versioned_encrypt(vc, nextval, version));
+}
+
+PG_FUNCTION_INFO_V1(reverse_permute_versioned);
+
+/*
+ * Decrypt a value produced by permute_nextval_versioned() with the same
+ * array of keys, whichever the version used to encrypt it.
+ */
+Datum
+reverse_permute_versioned(PG_FUNCTION_ARGS)
+{
+	Oid seq_oid = PG_GETARG_OID(0);
+	int64 value = PG_GETARG_INT64(1);
+	ArrayType *keys = PG_GETARG_ARRAYTYPE_P(2);
+	int64 minval, maxval;
+	CipherOptions opts;
+	VersionedCipher *vc;
+
+	get_reversible_sequence_range(seq_oid, &minval, &maxval, &opts);
+
+	vc = get_cached_versioned_cipher(fcinfo, minval, maxval, keys, &opts);
+
+	PG_RETURN_INT64(versioned_decrypt(vc, value));
+}
+
+PG_FUNCTION_INFO_V1(range_expected_walks);
+
+/*
+ * Average number of passes through the Feistel network needed to
+ * encrypt or decrypt a value of [minval,maxval] with the given algorithm.
+ * Since the cycle walking visits each element of the domain of the
+ * network that is outside of the interval exactly once when going over
+ * all the values, it's the size of the domain divided by the size of
+ * the interval.
+ */
+Datum
+range_expected_walks(PG_FUNCTION_ARGS)
+{
+	int64 minval = PG_GETARG_INT64(0);
+	int64 maxval = PG_GETARG_INT64(1);
+	CipherOptions opts;
+	CipherContext ctx;
+	double interval;
+
+	get_cipher_options_args(fcinfo, 2, &opts);
+
+	if (minval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid range: [%"PRId64",%"PRId64"]", minval, maxval)));
+	}
+
+	cipher_init(&ctx, minval, maxval, 0, &opts);
+
+	interval = (double) ctx.max_offset + 1.0;
+
+	PG_RETURN_FLOAT8(cipher_domain_size(&ctx) / interval);
+}
+
+/*
+ * State of range_permutation() and range_permutation_chunk() across calls.
+ * The values are encrypted CIPHER_CHUNK at a time into buf.
+ */
+typedef struct RangePermutationState
+{
+	CipherContext ctx;
+	uint64		next;		/* offset of the next position to encrypt */
+	uint64		last;		/* offset of the last position to encrypt */
+	bool		done;		/* all the positions are encrypted */
+	int		buf_len;
+	int		buf_pos;
+	int64		buf[CIPHER_CHUNK];
+} RangePermutationState;
+
+/*
+ * Common code for range_permutation() and range_permutation_chunk():
+ * return the encrypted values of the positions of [minval,maxval]
+ * whose offsets are in [first,last], one per call, with the cipher
+ * initialized at the first call from the first 3 arguments and the
+ * algorithm and rounds, which are the 6th and 7th arguments when passed.
+ * If empty is true, there is no position to return.
+ */
+static Datum
+range_permutation_srf(FunctionCallInfo fcinfo, uint64 first, uint64 last,
+		      bool empty)
+{
+	FuncCallContext *funcctx;
+	RangePermutationState *state;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		int64 minval = PG_GETARG_INT64(0);
+		int64 maxval = PG_GETARG_INT64(1);
+		uint64 crypt_key = PG_GETARG_INT64(2);
+		CipherOptions opts;
+
+		get_cipher_options_args(fcinfo, 5, &opts);
+		check_cipher_range(minval, maxval);
+
+		funcctx = SRF_FIRSTCALL_INIT();
+
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+		state = (RangePermutationState *) palloc(sizeof(RangePermutationState));
+		cipher_init(&state->ctx, minval, maxval, crypt_key, &opts);
+		state->next = first;
+		state->last = last;
+		state->done = empty;
+		state->buf_len = 0;
+		state->buf_pos = 0;
+		MemoryContextSwitchTo(oldcontext);
+
+		funcctx->user_fctx = state;
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	state = (RangePermutationState *) funcctx->user_fctx;
+
+	if (state->buf_pos == state->buf_len && !state->done)
+	{
+		/* Number of positions left, minus 1, which doesn't overflow
+		   when the whole interval spans 2^64 values. */
+		uint64 left = state->last - state->next;
+		int n = (left >= CIPHER_CHUNK - 1) ? CIPHER_CHUNK : (int) left + 1;
+		int i;
+
+		for (i = 0; i < n; i++)
+			state->buf[i] = (int64) ((uint64) state->ctx.minval + state->next + i);
+
+		cycle_walking_cipher_batch(&state->ctx, state->buf, state->buf, n, 0);
+
+		if (n == left + 1)
+			state->done = true;
+		else
+			state->next += n;
+		state->buf_len = n;
+		state->buf_pos = 0;
+	}
+
+	if (state->buf_pos < state->buf_len)
+		SRF_RETURN_NEXT(funcctx, Int64GetDatum(state->buf[state->buf_pos++]));
+	else
+		SRF_RETURN_DONE(funcctx);
+}
+
+PG_FUNCTION_INFO_V1(range_permutation);
+
+/*
+ * Return all the values of [minval,maxval] permuted with the key, that is
+ * range_encrypt_element() of minval, minval+1, ..., maxval, in that order.
+ * The values are computed as they are returned, so the permutation is
+ * never materialized.
+ * With the optional offset and count arguments, return only count values
+ * starting at offset (from 0) in the permutation, or fewer if the end of
+ * the range is reached, so that it can be read by pages. The algorithm
+ * and number of rounds can only be passed after them.
+ */
+Datum
+range_permutation(PG_FUNCTION_ARGS)
+{
+	int64 minval = PG_GETARG_INT64(0);
+	int64 maxval = PG_GETARG_INT64(1);
+	uint64 max_offset;
+	int64 offset, count;
+
+	if (minval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid range: [%"PRId64",%"PRId64"]", minval, maxval)));
+	}
+
+	max_offset = (uint64) maxval - (uint64) minval;
+
+	if (PG_NARGS() <= 3)
+		return range_permutation_srf(fcinfo, 0, max_offset, false);
+
+	offset = PG_GETARG_INT64(3);
+	count = PG_GETARG_INT64(4);
+
+	if (offset < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("offset must not be negative")));
+	}
+	if (count < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("count must not be negative")));
+	}
+
+	if (count == 0 || (uint64) offset > max_offset)
+		return range_permutation_srf(fcinfo, 0, 0, true);
+
+	return range_permutation_srf(fcinfo, (uint64) offset,
+				     ((uint64) count - 1 > max_offset - (uint64) offset) ?
+				     max_offset : (uint64) offset + (uint64) count - 1,
+				     false);
+}
+
+PG_FUNCTION_INFO_V1(range_permutation_chunk);
+
+/*
+ * Return the part number chunk_no (from 0) of the output of
+ * range_permutation(), cut into chunk_count parts of equal size
+ * (within one element). The parts being independent, they can be
+ * computed in parallel, by different workers or sessions, and their
+ * concatenation in order is the whole permutation.
+ */
+Datum
+range_permutation_chunk(PG_FUNCTION_ARGS)
+{
+	int64 minval = PG_GETARG_INT64(0);
+	int64 maxval = PG_GETARG_INT64(1);
+	int32 chunk_no = PG_GETARG_INT32(3);
+	int32 chunk_count = PG_GETARG_INT32(4);
+	uint64 max_offset;
+	uint64 size, rem, first, last;
+	bool empty;
+
+	if (minval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid range: [%"PRId64",%"PRId64"]", minval, maxval)));
+	}
+	if (chunk_count < 1 || chunk_no < 0 || chunk_no >= chunk_count)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid chunk number %d for %d chunks", chunk_no, chunk_count),
+				errhint("The chunk number must be between 0 and the number of chunks minus 1.")));
+	}
+
+	/* The number of values is max_offset+1, which may be 2^64. The first
+	   rem chunks have size+1 values, the others have size values. */
+	max_offset = (uint64) maxval - (uint64) minval;
+	size = max_offset / chunk_count;
+	rem = max_offset % chunk_count + 1;
+	if (rem == chunk_count)
+	{
+		size++;		/* wraps to 0 for 2^64 values in 1 chunk */
+		rem = 0;
+	}
+
+	first = size * chunk_no + Min((uint64) chunk_no, rem);
+	last = first + size - 1 + ((uint64) chunk_no < rem ? 1 : 0);
+	/* there are fewer values than chunks, and this one is past them */
+	empty = (max_offset < (uint64) (chunk_count - 1) &&
+		 (uint64) chunk_no > max_offset);
+
+	return range_permutation_srf(fcinfo, first, last, empty);
+}
+
+/*
+ * Common code for range_sample(), range_sample_filtered() and
+ * range_permutation_window(): return an array of the values of the
+ * permutation of [minval,maxval] from the offset first that are in
+ * [filter_min,filter_max], up to count values, encrypting the positions
+ * CIPHER_CHUNK at a time. The options of the cipher are at argument
+ * optarg.
+ */
+static Datum
+range_sample_internal(FunctionCallInfo fcinfo, uint64 first, int64 count,
+		      int64 filter_min, int64 filter_max, int optarg)
+{
+	int64 minval = PG_GETARG_INT64(0);
+	int64 maxval = PG_GETARG_INT64(1);
+	uint64 crypt_key = PG_GETARG_INT64(2);
+	CipherOptions opts;
+	CipherContext *ctx;
+	uint64 max_offset;
+	uint64 next = first;
+	bool done = false;
+	ArrayType *result;
+	int64 *elems;
+	int nelems = 0;
+	int64 buf[CIPHER_CHUNK];
+
+	get_cipher_options_args(fcinfo, optarg, &opts);
+
+	if (minval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid range: [%"PRId64",%"PRId64"]", minval, maxval)));
+	}
+	check_batch_count(count);
+	check_int8_array_count(count, "range_permutation");
+
+	max_offset = (uint64) maxval - (uint64) minval;
+
+	/* There can't be more values than the positions from first or the
+	   filter have */
+	filter_min = Max(filter_min, minval);
+	filter_max = Min(filter_max, maxval);
+	if (filter_min > filter_max || first > max_offset)
+		count = 0;
+	if (count > 0 && (uint64) count - 1 > (uint64) filter_max - (uint64) filter_min)
+		count = (int64) ((uint64) filter_max - (uint64) filter_min + 1);
+	if (count > 0 && (uint64) count - 1 > max_offset - first)
+		count = (int64) (max_offset - first + 1);
+
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+
+	if (count == 0)
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT8OID));
+
+	result = new_int8_array((int) count);
+	elems = (int64 *) ARR_DATA_PTR(result);
+
+	while (nelems < count && !done)
+	{
+		/* Number of positions left, minus 1, as in range_permutation_srf() */
+		uint64 left = max_offset - next;
+		int n = (left >= CIPHER_CHUNK - 1) ? CIPHER_CHUNK : (int) left + 1;
+		int i;
+
+		CHECK_FOR_INTERRUPTS();
+
+		for (i = 0; i < n; i++)
+			buf[i] = (int64) ((uint64) minval + next + i);
+
+		cycle_walking_cipher_batch(ctx, buf, buf, n, 0);
+
+		for (i = 0; i < n && nelems < count; i++)
+		{
+			if (buf[i] >= filter_min && buf[i] <= filter_max)
+				elems[nelems++] = buf[i];
+		}
+
+		if (n == left + 1)
+			done = true;
+		else
+			next += n;
+	}
+
+	/* with count capped as above, all the values are found before the
+	   positions are exhausted, but shrink the array otherwise */
+	if (nelems == 0)
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(INT8OID));
+	if (nelems < count)
+	{
+		ARR_DIMS(result)[0] = nelems;
+		SET_VARSIZE(result, ARR_OVERHEAD_NONULLS(1) + (Size) nelems * sizeof(int64));
+	}
+
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
+PG_FUNCTION_INFO_V1(range_sample);
+
+/*
+ * Return the first count values of the permutation of [minval,maxval],
+ * that is a sample without replacement of the range, always the same
+ * for a given key, as a bigint[] array.
+ */
+Datum
+range_sample(PG_FUNCTION_ARGS)
+{
+	return range_sample_internal(fcinfo, 0, PG_GETARG_INT64(3),
+				     PG_INT64_MIN, PG_INT64_MAX, 4);
+}
+
+PG_FUNCTION_INFO_V1(range_sample_filtered);
+
+/*
+ * Same as range_sample() keeping only the values that are within
+ * [filter_min,filter_max], so that the sample is a sample of that
+ * sub-range, in the order of the permutation of the whole range.
+ * The number of positions encrypted is about count times the ratio of
+ * the sizes of the range and of the filter.
+ */
+Datum
+range_sample_filtered(PG_FUNCTION_ARGS)
+{
+	return range_sample_internal(fcinfo, 0, PG_GETARG_INT64(3),
+				     PG_GETARG_INT64(4), PG_GETARG_INT64(5), 6);
+}
+
+PG_FUNCTION_INFO_V1(range_permutation_window);
+
+/*
+ * Return count values of the permutation of [minval,maxval] from the
+ * rank start_rank (from 0), as range_permutation() with an offset and a
+ * count, but as an array, with the options of the cipher and with the
+ * cipher kept across calls, for pages of a shuffled list.
+ */
+Datum
+range_permutation_window(PG_FUNCTION_ARGS)
+{
+	int64 start_rank = PG_GETARG_INT64(3);
+
+	if (start_rank < 0)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("rank must not be negative")));
+	}
+
+	return range_sample_internal(fcinfo, (uint64) start_rank, PG_GETARG_INT64(4),
+				     PG_INT64_MIN, PG_INT64_MAX, 5);
+}
+
+PG_FUNCTION_INFO_V1(range_value_at);
+
+/*
+ * Return the value at the rank (from 0) of the permutation of
+ * [minval,maxval], that is range_encrypt_element(minval + rank).
+ */
+Datum
+range_value_at(PG_FUNCTION_ARGS)
+{
+	int64 rank = PG_GETARG_INT64(0);
+	int64 minval = PG_GETARG_INT64(1);
+	int64 maxval = PG_GETARG_INT64(2);
+	uint64 crypt_key = PG_GETARG_INT64(3);
+	CipherOptions opts;
+	CipherContext *ctx;
+
+	get_cipher_options_args(fcinfo, 4, &opts);
+
+	if (minval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid range: [%"PRId64",%"PRId64"]", minval, maxval)));
+	}
+	if (rank < 0 || (uint64) rank > (uint64) maxval - (uint64) minval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid rank: %"PRId64" is outside of the permutation of range [%"PRId64",%"PRId64"]",
+				       rank, minval, maxval)));
+	}
+
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+
+	PG_RETURN_INT64(cycle_walking_cipher(ctx, (int64) ((uint64) minval + (uint64) rank), 0));
+}
+
+PG_FUNCTION_INFO_V1(range_position_of);
+
+/*
+ * Return the rank (from 0) of a value in the permutation of
+ * [minval,maxval], so that range_value_at() of the result is the value.
+ */
+Datum
+range_position_of(PG_FUNCTION_ARGS)
+{
+	int64 cryptval = PG_GETARG_INT64(0);
+	int64 minval = PG_GETARG_INT64(1);
+	int64 maxval = PG_GETARG_INT64(2);
+	uint64 crypt_key = PG_GETARG_INT64(3);
+	CipherOptions opts;
+	CipherContext *ctx;
+	uint64 rank;
+
+	get_cipher_options_args(fcinfo, 4, &opts);
+
+	if (cryptval < minval || cryptval > maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("invalid value: %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
+				       cryptval, minval, maxval)));
+	}
+
+	ctx = get_cached_cipher(fcinfo, minval, maxval, crypt_key, &opts);
+	rank = (uint64) cycle_walking_cipher(ctx, cryptval, 1) - (uint64) minval;
+
+	/* only possible for ranges of more than 2^63 values */
+	if (rank > (uint64) PG_INT64_MAX)
+	{
+		ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				errmsg("rank of value %"PRId64" is out of range for type bigint",
+				       cryptval)));
+	}
+
+	PG_RETURN_INT64((int64) rank);
+}
+
+/*
+ * Insert or update the row of a sequence in the permuteseq_sequences
+ * table, with query_fmt being the INSERT query in which the schema and
+ * name of the table are substituted, and $1 the sequence.
+ * Only the owner of the sequence may do that. The table itself is
+ * written with the privileges of its owner.
+ */
+static void
+store_sequence_row(Oid seq_oid, const char *query_fmt, int nargs,
+		   Oid *argtypes, Datum *values)
+{
+	Oid relid;
+	HeapTuple tuple;
+	Oid table_owner;
+	Oid save_userid;
+	int save_sec_context;
+	char *query;
+
+	if (get_rel_relkind(seq_oid) != RELKIND_SEQUENCE)
+	{
+		ereport(ERROR, (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+				errmsg("\"%s\" is not a sequence", get_rel_name(seq_oid))));
+	}
+
+#if PG_VERSION_NUM >= 160000
+	if (!object_ownercheck(RelationRelationId, seq_oid, GetUserId()))
+#else
+	if (!pg_class_ownercheck(seq_oid, GetUserId()))
+#endif
+	{
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				errmsg("must be owner of sequence %s", get_rel_name(seq_oid))));
+	}
+
+	relid = get_sequences_table_oid();
+	if (!OidIsValid(relid))
+		elog(ERROR, "table %s of extension permuteseq not found", SEQUENCES_TABLE_NAME);
+
+	tuple = SearchSysCache1(RELOID, ObjectIdGetDatum(relid));
+	if (!HeapTupleIsValid(tuple))
+		elog(ERROR, "cache lookup failed for relation %u", relid);
+	table_owner = ((Form_pg_class) GETSTRUCT(tuple))->relowner;
+	ReleaseSysCache(tuple);
+
+	query = psprintf(query_fmt,
+			 quote_identifier(get_namespace_name(get_rel_namespace(relid))),
+			 quote_identifier(SEQUENCES_TABLE_NAME));
+
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(table_owner,
+			       save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+	if (SPI_connect() != SPI_OK_CONNECT)
+		elog(ERROR, "SPI_connect failed");
+	if (SPI_execute_with_args(query, nargs, argtypes, values, NULL, false, 0) != SPI_OK_INSERT)
+		elog(ERROR, "failed to store the options of sequence %u", seq_oid);
+	SPI_finish();
+
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_set_options);
+
+/*
+ * Set the options of the permutation of a sequence, stored in the
+ * permuteseq_sequences table and used by permute_nextval() and
+ * reverse_permute().
+ */
+Datum
+permuteseq_set_options(PG_FUNCTION_ARGS)
+{
+	Oid seq_oid = PG_GETARG_OID(0);
+	CipherOptions opts;
+	Oid argtypes[3] = {REGCLASSOID, INT4OID, INT4OID};
+	Datum values[3];
+
+	get_cipher_options_args(fcinfo, 1, &opts);
+
+	values[0] = ObjectIdGetDatum(seq_oid);
+	values[1] = Int32GetDatum(opts.algorithm);
+	values[2] = Int32GetDatum(opts.rounds);
+
+	store_sequence_row(seq_oid,
+			   "INSERT INTO %s.%s(seq, algorithm, rounds) VALUES ($1, $2, $3)"
+			   " ON CONFLICT (seq) DO UPDATE SET algorithm = EXCLUDED.algorithm,"
+			   " rounds = EXCLUDED.rounds",
+			   3, argtypes, values);
+
+	PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_register);
+
+/*
+ * Register a sequence with a key and the options of its permutation,
+ * for permuteseq_nextval() and permuteseq_reverse(), which then don't
+ * need the key to be passed by the caller.
+ */
+Datum
+permuteseq_register(PG_FUNCTION_ARGS)
+{
+	Oid seq_oid = PG_GETARG_OID(0);
+	int64 crypt_key = PG_GETARG_INT64(1);
+	CipherOptions opts;
+	Oid argtypes[4] = {REGCLASSOID, INT8OID, INT4OID, INT4OID};
+	Datum values[4];
+
+	get_cipher_options_args(fcinfo, 2, &opts);
+
+	values[0] = ObjectIdGetDatum(seq_oid);
+	values[1] = Int64GetDatum(crypt_key);
+	values[2] = Int32GetDatum(opts.algorithm);
+	values[3] = Int32GetDatum(opts.rounds);
+
+	store_sequence_row(seq_oid,
+			   "INSERT INTO %s.%s(seq, crypt_key, algorithm, rounds)"
+			   " VALUES ($1, $2, $3, $4)"
+			   " ON CONFLICT (seq) DO UPDATE SET crypt_key = EXCLUDED.crypt_key,"
+			   " algorithm = EXCLUDED.algorithm, rounds = EXCLUDED.rounds",
+			   4, argtypes, values);
+
+	PG_RETURN_VOID();
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_nextval);
+
+/*
+ * Same as permute_nextval() for a sequence registered with
+ * permuteseq_register(), with its key and options.
+ * The cipher is kept in the backend-local cache of the sequence, so
+ * that the range and the key are only processed when the entry is
+ * filled.
+ */
+Datum
+permuteseq_nextval(PG_FUNCTION_ARGS)
+{
+	Oid seq_oid = PG_GETARG_OID(0);
+	SequenceBoundsEntry *entry = get_registered_sequence(seq_oid);
+	int64 nextval;
+
+	if (prealloc_block_size > 0)
+		PG_RETURN_INT64(next_preallocated_value(seq_oid, &entry->cipher));
+
+	/* Invalidations processed by nextval don't change the entry contents */
+	nextval = sequence_next_position(seq_oid, entry->minval, entry->maxval, true);
+
+	PG_RETURN_INT64(cycle_walking_cipher(&entry->cipher, nextval, 0));
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_reverse);
+
+/*
+ * Same as reverse_permute() for a sequence registered with
+ * permuteseq_register().
+ */
+Datum
+permuteseq_reverse(PG_FUNCTION_ARGS)
+{
+	Oid seq_oid = PG_GETARG_OID(0);
+	int64 value = PG_GETARG_INT64(1);
+	SequenceBoundsEntry *entry = get_registered_sequence(seq_oid);
+
+	if (value < entry->minval || value > entry->maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				errmsg("value out of sequence bounds.")));
+	}
+
+	PG_RETURN_INT64(cycle_walking_cipher(&entry->cipher, value, 1));
+}
+
+/*
+ * Types created by permuteseq_create_type() store the clear positions of
+ * a registered sequence as int8, and their I/O functions below decrypt
+ * the values on input and encrypt them on output, with the key of the
+ * sequence. Each type has its own SQL-level I/O functions, bound to
+ * these C functions. The type comes from the typioparam argument
+ * for input, and from the argument type of the function for output.
+ * The sequence of the type is looked up once per query and cached in
+ * fn_extra.
+ */
+typedef struct TypeSequenceCache
+{
+	Oid		typoid;
+	Oid		seq_oid;
+} TypeSequenceCache;
+
+static Oid
+fetch_type_sequence(Oid typoid)
+{
+	Oid relid = get_extension_table_oid(TYPES_TABLE_NAME);
+	Relation rel;
+	SysScanDesc scan;
+	ScanKeyData key;
+	HeapTuple tuple;
+	Oid seq_oid = InvalidOid;
+
+	if (OidIsValid(relid))
+	{
+		rel = table_open(relid, AccessShareLock);
+
+		ScanKeyInit(&key,
+			    Anum_permuteseq_types_typ,
+			    BTEqualStrategyNumber, F_OIDEQ,
+			    ObjectIdGetDatum(typoid));
+
+		scan = systable_beginscan(rel, InvalidOid, false, NULL, 1, &key);
+
+		tuple = systable_getnext(scan);
+		if (HeapTupleIsValid(tuple))
+		{
+			bool isnull;
+			Datum d = heap_getattr(tuple, Anum_permuteseq_types_seq,
+					       RelationGetDescr(rel), &isnull);
+
+			if (!isnull)
+				seq_oid = DatumGetObjectId(d);
+		}
+
+		systable_endscan(scan);
+		table_close(rel, AccessShareLock);
+	}
+
+	if (!OidIsValid(seq_oid))
+	{
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				errmsg("type %s was not created by permuteseq_create_type()",
+				       format_type_be(typoid)),
+				errhint("When restoring a dump, the data of %s and permuteseq_sequences must be restored before the columns of this type.",
+					TYPES_TABLE_NAME)));
+	}
+
+	return seq_oid;
+}
+
+/*
+ * Return the cache entry of the registered sequence of a type. If typoid
+ * is InvalidOid, the type is the type of the first argument of the
+ * function.
+ */
+static SequenceBoundsEntry *
+get_type_sequence(FunctionCallInfo fcinfo, Oid typoid)
+{
+	TypeSequenceCache *cache = (TypeSequenceCache *) fcinfo->flinfo->fn_extra;
+
+	if (cache == NULL)
+	{
+		cache = (TypeSequenceCache *) MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+								 sizeof(TypeSequenceCache));
+		cache->typoid = InvalidOid;
+		fcinfo->flinfo->fn_extra = cache;
+	}
+
+	if (!OidIsValid(typoid))
+	{
+		if (!OidIsValid(cache->typoid))
+		{
+			Oid *argtypes;
+			int nargs;
+
+			get_func_signature(fcinfo->flinfo->fn_oid, &argtypes, &nargs);
+			if (nargs != 1)
+				elog(ERROR, "unexpected signature for output function %u",
+				     fcinfo->flinfo->fn_oid);
+			typoid = argtypes[0];
+		}
+		else
+			typoid = cache->typoid;
+	}
+
+	if (cache->typoid != typoid)
+	{
+		cache->seq_oid = fetch_type_sequence(typoid);
+		cache->typoid = typoid;
+	}
+
+	return get_registered_sequence(cache->seq_oid);
+}
+
+/*
+ * Decrypt an external value of a type, checking that it's in the
+ * range of the sequence.
+ */
+static int64
+type_value_decrypt(SequenceBoundsEntry *entry, int64 value)
+{
+	if (value < entry->minval || value > entry->maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				errmsg("value %"PRId64" is outside of range [%"PRId64",%"PRId64"]",
+				       value, entry->minval, entry->maxval)));
+	}
+	return cycle_walking_cipher(&entry->cipher, value, 1);
+}
+
+/*
+ * Encrypt a stored value of a type. It may be outside of the range if
+ * it was stored before the sequence was altered.
+ */
+static int64
+type_value_encrypt(SequenceBoundsEntry *entry, int64 value)
+{
+	if (value < entry->minval || value > entry->maxval)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_EXCEPTION),
+				errmsg("stored value is outside of the range of sequence %s",
+				       get_rel_name(entry->seq_oid))));
+	}
+	return cycle_walking_cipher(&entry->cipher, value, 0);
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_type_in);
+
+Datum
+permuteseq_type_in(PG_FUNCTION_ARGS)
+{
+	Datum value = DirectFunctionCall1(int8in, PG_GETARG_DATUM(0));
+	SequenceBoundsEntry *entry = get_type_sequence(fcinfo, PG_GETARG_OID(1));
+
+	PG_RETURN_INT64(type_value_decrypt(entry, DatumGetInt64(value)));
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_type_out);
+
+Datum
+permuteseq_type_out(PG_FUNCTION_ARGS)
+{
+	int64 value = PG_GETARG_INT64(0);
+	SequenceBoundsEntry *entry = get_type_sequence(fcinfo, InvalidOid);
+
+	return DirectFunctionCall1(int8out,
+				   Int64GetDatum(type_value_encrypt(entry, value)));
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_type_recv);
+
+Datum
+permuteseq_type_recv(PG_FUNCTION_ARGS)
+{
+	Datum value = DirectFunctionCall1(int8recv, PG_GETARG_DATUM(0));
+	SequenceBoundsEntry *entry = get_type_sequence(fcinfo, PG_GETARG_OID(1));
+
+	PG_RETURN_INT64(type_value_decrypt(entry, DatumGetInt64(value)));
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_type_send);
+
+Datum
+permuteseq_type_send(PG_FUNCTION_ARGS)
+{
+	int64 value = PG_GETARG_INT64(0);
+	SequenceBoundsEntry *entry = get_type_sequence(fcinfo, InvalidOid);
+
+	return DirectFunctionCall1(int8send,
+				   Int64GetDatum(type_value_encrypt(entry, value)));
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_sequences_trigger);
+
+/*
+ * Statement trigger on permuteseq_sequences, invalidating the cached
+ * options of the sequences in all backends when the table changes.
+ */
+Datum
+permuteseq_sequences_trigger(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "permuteseq_sequences_trigger: not called by trigger manager");
+
+	/* the relcache callback of each backend will see this */
+	CacheInvalidateRelcache(trigdata->tg_relation);
+
+	return PointerGetDatum(NULL);
+}
+
+/*
+ * Raise the error of a cycle walking that doesn't end, for
+ * permuteseq_cipher.c. It's mainly to avoid an infinite loop in case the
+ * chain of results has a cycle, which would imply a bug somewhere.
+ */
+void
+cipher_walk_failed(int64 value, int walk_max)
+{
+	ereport(ERROR, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			errmsg("infinite cycle walking prevented for value %"PRId64" (%d loops)",
+			       value, walk_max)));
+}
+
+/*
+ * Return the cipher context cached in fn_extra for the calling function,
+ * initializing or resetting it if it's absent or doesn't correspond to
+ * the range, the key or the options.
+ * The context is kept in fn_mcxt, so that it persists across calls
+ * within the same query.
+ */
+static CipherContext *
+get_cached_cipher(FunctionCallInfo fcinfo, int64 minval, int64 maxval,
+		  uint64 crypt_key, const CipherOptions *opts)
+{
+	CipherContext *ctx = (CipherContext *) fcinfo->flinfo->fn_extra;
+
+	if (ctx == NULL)
+	{
+		check_cipher_range(minval, maxval);
+		ctx = (CipherContext *) MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+							   sizeof(CipherContext));
+		cipher_init_shared(ctx, minval, maxval, crypt_key, opts);
+		fcinfo->flinfo->fn_extra = ctx;
+		permuteseq_local_stats.context_misses++;
+	}
+	else if (ctx->minval != minval || ctx->maxval != maxval ||
+		 ctx->crypt_key != crypt_key ||
+		 ctx->opts.algorithm != opts->algorithm ||
+		 ctx->opts.rounds != opts->rounds)
+	{
+		check_cipher_range(minval, maxval);
+		cipher_init_shared(ctx, minval, maxval, crypt_key, opts);
+		permuteseq_local_stats.context_misses++;
+	}
+	else
+		permuteseq_local_stats.context_hits++;
+
+	lookup_table_attach(ctx);
+
+	return ctx;
+}
+
+/*
+ * Backend-local cache of the lookup tables of the permutations of small
+ * intervals, in LOOKUP_TABLE_SLOTS slots reused in LRU order.
+ * A CipherContext using the tables of a slot holds the generation of
+ * the slot at the time, and lookup_table_attach() must be called to
+ * check that it's still current before each use of the context after
+ * others may have been attached. It's done by get_cached_cipher() and
+ * get_registered_sequence(); the contexts initialized otherwise don't
+ * use the tables.
+ * To avoid building tables for permutations used only once, the tables
+ * are built the second time they're asked for, the previous requests
+ * being kept in a ring of LOOKUP_TABLE_CANDIDATES.
+ */
+#define LOOKUP_TABLE_SLOTS	8
+#define LOOKUP_TABLE_CANDIDATES	32
+
+typedef struct LookupTableKey
+{
+	int64		minval;
+	int64		maxval;
+	uint64		crypt_key;
+	CipherOptions	opts;
+} LookupTableKey;
+
+typedef struct LookupTable
+{
+	uint64		generation;	/* 0 if the slot is free */
+	uint64		last_used;
+	LookupTableKey	key;
+	uint32	   *encrypt;	/* both tables in a single allocation */
+	uint32	   *decrypt;	/* pointing after encrypt */
+} LookupTable;
+
+static LookupTable lookup_tables[LOOKUP_TABLE_SLOTS];
+static uint64 lookup_table_generation = 0;
+static uint64 lookup_table_clock = 0;
+
+static LookupTableKey lookup_table_candidates[LOOKUP_TABLE_CANDIDATES];
+static int lookup_table_ncandidates = 0;
+static int lookup_table_next_candidate = 0;
+
+static bool
+lookup_table_key_matches(const LookupTableKey *key, const CipherContext *ctx)
+{
+	return key->minval == ctx->minval && key->maxval == ctx->maxval &&
+		key->crypt_key == ctx->crypt_key &&
+		key->opts.algorithm == ctx->opts.algorithm &&
+		key->opts.rounds == ctx->opts.rounds;
+}
+
+/*
+ * Same as cipher_init(), getting the context from the shared cache
+ * if another backend has already computed it, or adding it to the cache.
+ */
+static void
+cipher_init_shared(CipherContext *ctx, int64 minval, int64 maxval,
+		   uint64 crypt_key, const CipherOptions *opts)
+{
+	LookupTableKey key;
+	uint32 hash;
+	SharedCipherSlot *target = NULL;
+	int probe;
+
+	if (shared_ciphers == NULL)
+	{
+		cipher_init(ctx, minval, maxval, crypt_key, opts);
+		return;
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.minval = minval;
+	key.maxval = maxval;
+	key.crypt_key = crypt_key;
+	key.opts = *opts;
+	hash = DatumGetUInt32(hash_any((const unsigned char *) &key, sizeof(key)));
+
+	for (probe = 0; probe < SHARED_CACHE_PROBES; probe++)
+	{
+		SharedCipherSlot *slot = &shared_ciphers[(hash + probe) % shared_cache_size];
+		uint32 before, after;
+
+		before = pg_atomic_read_u32(&slot->changecount);
+		if (before == 0)
+		{
+			/* the context would have been put into this slot
+			   rather than into the next ones */
+			if (target == NULL)
+				target = slot;
+			break;
+		}
+		if (before & 1)
+			continue;
+
+		pg_read_barrier();
+		memcpy(ctx, &slot->ctx, sizeof(CipherContext));
+		pg_read_barrier();
+		after = pg_atomic_read_u32(&slot->changecount);
+
+		if (after == before &&
+		    lookup_table_key_matches(&key, ctx))
+		{
+			/* the lookup tables are local */
+			ctx->lut_encrypt = NULL;
+			ctx->lut_decrypt = NULL;
+			ctx->lut_slot = -1;
+			ctx->lut_generation = 0;
+			permuteseq_local_stats.shared_hits++;
+			return;
+		}
+		if (target == NULL && probe == 0)
+			target = slot;
+	}
+
+	permuteseq_local_stats.shared_misses++;
+	cipher_init(ctx, minval, maxval, crypt_key, opts);
+
+	/* Publish the context into the first empty slot, or replace the
+	   context of the first slot, unless another backend is writing it. */
+	if (target == NULL)
+		target = &shared_ciphers[hash % shared_cache_size];
+	{
+		uint32 count = pg_atomic_read_u32(&target->changecount);
+
+		if ((count & 1) == 0 &&
+		    pg_atomic_compare_exchange_u32(&target->changecount, &count, count + 1))
+		{
+			memcpy(&target->ctx, ctx, sizeof(CipherContext));
+			pg_write_barrier();
+			/* skip 0 when wrapping around, since it means empty */
+			pg_atomic_write_u32(&target->changecount,
+					    (count + 2 == 0) ? 2 : count + 2);
+		}
+	}
+}
+
+/*
+ * Compute the tables of the permutation of ctx into a slot, with the
+ * batch cipher. ctx must not be attached to tables.
+ * The slot is marked free while the tables are computed, and they
+ * replace its previous ones only once complete, so that an error
+ * (out of memory) leaves it free with consistent contents.
+ */
+static void
+lookup_table_build(LookupTable *slot, const CipherContext *ctx)
+{
+	uint32 n = (uint32) ctx->max_offset + 1;
+	int64 buf[CIPHER_CHUNK];
+	uint32 *encrypt;
+	uint32 *decrypt;
+	uint32 base;
+
+	slot->generation = 0;
+
+	encrypt = (uint32 *) MemoryContextAlloc(TopMemoryContext, 2 * n * sizeof(uint32));
+	decrypt = encrypt + n;
+
+	for (base = 0; base < n; base += CIPHER_CHUNK)
+	{
+		int count = (int) Min(CIPHER_CHUNK, n - base);
+		int i;
+
+		for (i = 0; i < count; i++)
+			buf[i] = ctx->minval + base + i;
+
+		cycle_walking_cipher_batch(ctx, buf, buf, count, 0);
+
+		for (i = 0; i < count; i++)
+		{
+			uint32 offset = (uint32) (buf[i] - ctx->minval);
+
+			encrypt[base + i] = offset;
+			decrypt[offset] = base + i;
+		}
+	}
+
+	if (slot->encrypt != NULL)
+		pfree(slot->encrypt);
+	slot->encrypt = encrypt;
+	slot->decrypt = decrypt;
+	slot->key.minval = ctx->minval;
+	slot->key.maxval = ctx->maxval;
+	slot->key.crypt_key = ctx->crypt_key;
+	slot->key.opts = ctx->opts;
+	slot->generation = ++lookup_table_generation;
+	permuteseq_local_stats.table_builds++;
+}
+
+/*
+ * Make ctx use the lookup tables of its permutation if its interval
+ * is small enough and they're in the cache, or build them if they
+ * have been asked for already. Otherwise ctx computes the values.
+ */
+static void
+lookup_table_attach(CipherContext *ctx)
+{
+	LookupTable *slot;
+	int i;
+
+	if (ctx->lut_slot >= 0 &&
+	    lookup_tables[ctx->lut_slot].generation == ctx->lut_generation)
+	{
+		lookup_tables[ctx->lut_slot].last_used = ++lookup_table_clock;
+		return;
+	}
+
+	ctx->lut_encrypt = NULL;
+	ctx->lut_decrypt = NULL;
+	ctx->lut_slot = -1;
+
+	if (ctx->max_offset >= (uint64) lookup_table_threshold)
+		return;
+
+	slot = NULL;
+	for (i = 0; i < LOOKUP_TABLE_SLOTS; i++)
+	{
+		if (lookup_tables[i].generation != 0 &&
+		    lookup_table_key_matches(&lookup_tables[i].key, ctx))
+		{
+			slot = &lookup_tables[i];
+			break;
+		}
+	}
+
+	if (slot == NULL)
+	{
+		bool asked = false;
+
+		for (i = 0; i < lookup_table_ncandidates; i++)
+		{
+			if (lookup_table_key_matches(&lookup_table_candidates[i], ctx))
+			{
+				asked = true;
+				break;
+			}
+		}
+
+		if (!asked)
+		{
+			LookupTableKey *key = &lookup_table_candidates[lookup_table_next_candidate];
+
+			key->minval = ctx->minval;
+			key->maxval = ctx->maxval;
+			key->crypt_key = ctx->crypt_key;
+			key->opts = ctx->opts;
+			lookup_table_next_candidate = (lookup_table_next_candidate + 1) % LOOKUP_TABLE_CANDIDATES;
+			if (lookup_table_ncandidates < LOOKUP_TABLE_CANDIDATES)
+				lookup_table_ncandidates++;
+			return;
+		}
+
+		/* reuse the least recently used slot */
+		slot = &lookup_tables[0];
+		for (i = 1; i < LOOKUP_TABLE_SLOTS; i++)
+		{
+			if (lookup_tables[i].last_used < slot->last_used)
+				slot = &lookup_tables[i];
+		}
+		lookup_table_build(slot, ctx);
+	}
+
+	slot->last_used = ++lookup_table_clock;
+	ctx->lut_encrypt = slot->encrypt;
+	ctx->lut_decrypt = slot->decrypt;
+	ctx->lut_slot = slot - lookup_tables;
+	ctx->lut_generation = slot->generation;
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_stats);
+
+/*
+ * Return the statistics of all backends, including the counters of
+ * the current backend not yet flushed, or only those of the current
+ * backend if the library is not preloaded.
+ */
+Datum
+permuteseq_stats(PG_FUNCTION_ARGS)
+{
+	PermuteseqStats stats;
+	TimestampTz stats_reset = 0;
+	bool have_reset = false;
+	TupleDesc tupdesc;
+	Datum values[12];
+	bool nulls[12];
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	if (shared_stats != NULL)
+	{
+		SpinLockAcquire(&shared_stats->mutex);
+		stats = shared_stats->stats;
+		stats_reset = shared_stats->stats_reset;
+		SpinLockRelease(&shared_stats->mutex);
+		have_reset = true;
+	}
+	else
+		memset(&stats, 0, sizeof(stats));
+
+	add_stats(&stats, &permuteseq_local_stats);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum((int64) stats.calls);
+	values[1] = Int64GetDatum((int64) stats.walks);
+	values[2] = Int64GetDatum((int64) stats.max_walks);
+	values[3] = Int64GetDatum((int64) stats.table_lookups);
+	values[4] = Int64GetDatum((int64) stats.table_builds);
+	values[5] = Int64GetDatum((int64) stats.context_hits);
+	values[6] = Int64GetDatum((int64) stats.context_misses);
+	values[7] = Int64GetDatum((int64) stats.bounds_hits);
+	values[8] = Int64GetDatum((int64) stats.bounds_misses);
+	values[9] = Int64GetDatum((int64) stats.shared_hits);
+	values[10] = Int64GetDatum((int64) stats.shared_misses);
+	if (have_reset)
+		values[11] = TimestampTzGetDatum(stats_reset);
+	else
+		nulls[11] = true;
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
+
+PG_FUNCTION_INFO_V1(permuteseq_stats_reset);
+
+/*
+ * Reset the shared statistics and those of the current backend.
+ * The counters of other backends not yet flushed are added later.
+ */
+Datum
+permuteseq_stats_reset(PG_FUNCTION_ARGS)
+{
+	memset(&permuteseq_local_stats, 0, sizeof(PermuteseqStats));
+
+	if (shared_stats != NULL)
+	{
+		TimestampTz now = GetCurrentTimestamp();
+
+		SpinLockAcquire(&shared_stats->mutex);
+		memset(&shared_stats->stats, 0, sizeof(PermuteseqStats));
+		shared_stats->stats_reset = now;
+		SpinLockRelease(&shared_stats->mutex);
 	}
 
-	/* Convert the offset in the interval to an absolute value, possibly negative. */
-	return minval + result;
+	PG_RETURN_VOID();
 }
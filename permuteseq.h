@@ -0,0 +1,267 @@
+/*
+ * permuteseq.h
+ *
+ * Declarations shared between the source files of the permuteseq extension.
+ *
+ * By Daniel Vérité, 2016-2023. See LICENSE.md
+ */
+
+#ifndef PERMUTESEQ_H
+#define PERMUTESEQ_H
+
+/*
+ * Number of rounds of the Feistel Network. At least 3 are needed for
+ * the output to look random. The default is what all versions up to 1.2
+ * used, so that the permutations do not change.
+ */
+#define PERMUTESEQ_MIN_ROUNDS		3
+#define PERMUTESEQ_MAX_ROUNDS		32
+#define PERMUTESEQ_DEFAULT_ROUNDS	9
+
+/*
+ * Algorithms, identified by a version number that is part of the
+ * definition of a permutation: the outputs of a given algorithm must
+ * never change, so that values permuted in the past can be decrypted.
+ * 1: round function hash(Ri) XOR hash(Ki), with Bob Jenkins' hash
+ *    (the original algorithm)
+ * 2: round function mix(Ri XOR hash(Ki)), where mix is the finalizer
+ *    of MurmurHash3 (two multiplications and three xorshifts), with
+ *    a shorter dependency chain than the hash.
+ * 3: modular Feistel network, with the same round function as 2, in
+ *    which the halves are digits in radices a and b, with a*b just
+ *    above the size of the interval, instead of bit fields. The round
+ *    adds the result of the round function modulo the radix instead of
+ *    XOR'ing it. Cycle walking takes about one pass per value for any
+ *    size of interval, instead of up to four.
+ * 4: modular Feistel networks as in 3, permuting exactly two overlapping
+ *    windows of the interval one after the other, without cycle walking.
+ *    Each value takes at most two passes.
+ * 5: a keyed affine permutation x -> (m*x + c) mod N of the offsets,
+ *    then the modular network of 4 over its lower window only, then
+ *    another affine permutation, so exactly one evaluation per value,
+ *    and at most one pass through the network. It's meant for hiding
+ *    the order of IDs rather than for random-looking permutations.
+ */
+#define PERMUTESEQ_ALGO_JENKINS	1
+#define PERMUTESEQ_ALGO_MIX	2
+#define PERMUTESEQ_ALGO_MODULAR	3
+#define PERMUTESEQ_ALGO_BOUNDED	4
+#define PERMUTESEQ_ALGO_AFFINE	5
+
+#define PERMUTESEQ_ALGO_DEFAULT	PERMUTESEQ_ALGO_JENKINS
+#define PERMUTESEQ_ALGO_MAX	PERMUTESEQ_ALGO_AFFINE
+
+/*
+ * Parameters of a permutation, beyond its range and key.
+ */
+typedef struct CipherOptions
+{
+	int		algorithm;	/* one of PERMUTESEQ_ALGO_* */
+	int		rounds;		/* number of rounds of the Feistel network */
+} CipherOptions;
+
+/*
+ * State of the cipher for a given range and key, computed once
+ * and then usable for any number of values.
+ */
+typedef struct CipherContext
+{
+	int64		minval;
+	int64		maxval;
+	uint64		crypt_key;	/* key as passed by the user */
+	uint64		max_offset;	/* maxval-minval, as an unsigned integer
+					 * since it may not fit in an int64 */
+	CipherOptions	opts;
+	unsigned int hsz;		/* half block size, in bits */
+	uint32		mask;		/* hsz right-most bits set */
+	uint64		radix_a;	/* radices of the halves for */
+	uint64		radix_b;	/* PERMUTESEQ_ALGO_MODULAR, _BOUNDED and _AFFINE */
+	uint64		upper_window;	/* start of the second window of
+					 * PERMUTESEQ_ALGO_BOUNDED */
+	/* multipliers, their inverses and increments of the affine
+	   permutations of PERMUTESEQ_ALGO_AFFINE, before and after the
+	   network, modulo the size of the interval */
+	uint64		affine_mul[2];
+	uint64		affine_inv[2];
+	uint64		affine_add[2];
+	uint32		round_keys[PERMUTESEQ_MAX_ROUNDS];	/* hash of the subkey
+								 * of each round */
+	/* Precomputed permutation of small intervals and its inverse, indexed
+	   by offsets into the interval, or NULL (see lookup_table_attach()) */
+	const uint32 *lut_encrypt;
+	const uint32 *lut_decrypt;
+	int		lut_slot;	/* slot of the tables in the cache, or -1 */
+	uint64		lut_generation;	/* generation of the slot when attached */
+} CipherContext;
+
+/*
+ * Same as hash_uint32(), i.e. Bob Jenkins' hash of a single 32-bit
+ * integer as implemented in PostgreSQL (see hash_bytes_uint32() in
+ * src/common/hashfn.c), but inlinable, which matters in the inner loop
+ * of the Feistel network and allows vectorizing the multi-lane version.
+ * The results must be exactly the same, since they determine the
+ * permutations.
+ */
+#define feistel_rot(x,k) (((x)<<(k)) | ((x)>>(32-(k))))
+
+#define FEISTEL_HASH_INIT	(0x9e3779b9 + (uint32) sizeof(uint32) + 3923095)
+
+static inline uint32
+feistel_hash(uint32 k)
+{
+	uint32 a, b, c;
+
+	a = b = c = FEISTEL_HASH_INIT;
+	a += k;
+
+	c ^= b; c -= feistel_rot(b,14);
+	a ^= c; a -= feistel_rot(c,11);
+	b ^= a; b -= feistel_rot(a,25);
+	c ^= b; c -= feistel_rot(b,16);
+	a ^= c; a -= feistel_rot(c, 4);
+	b ^= a; b -= feistel_rot(a,14);
+	c ^= b; c -= feistel_rot(b,24);
+
+	return c;
+}
+
+/*
+ * Finalizer of MurmurHash3 (by Austin Appleby, public domain).
+ * Used as the round function of all the algorithms except
+ * PERMUTESEQ_ALGO_JENKINS.
+ */
+static inline uint32
+feistel_mix(uint32 x)
+{
+	x ^= x >> 16;
+	x *= 0x85ebca6b;
+	x ^= x >> 13;
+	x *= 0xc2b2ae35;
+	x ^= x >> 16;
+
+	return x;
+}
+
+/*
+ * Round function of the Feistel network for the given algorithm,
+ * rk being the hash of the round subkey.
+ */
+static inline uint32
+feistel_round_function(int algorithm, uint32 r, uint32 rk)
+{
+	if (algorithm != PERMUTESEQ_ALGO_JENKINS)
+		return feistel_mix(r ^ rk);
+	else
+		return feistel_hash(r) ^ rk;
+}
+
+/*
+ * Call impl(ctx, ..., algorithm, nr) with a constant algorithm and,
+ * for the most common numbers of rounds, a constant number of rounds,
+ * so that the compiler can produce specialized versions of impl with
+ * unrolled loops and no test on the algorithm in the rounds.
+ * This is only for the algorithms using a binary network, not for
+ * PERMUTESEQ_ALGO_MODULAR, PERMUTESEQ_ALGO_BOUNDED and
+ * PERMUTESEQ_ALGO_AFFINE.
+ */
+#define FEISTEL_DISPATCH_ROUNDS(impl, ctx, algorithm, ...) \
+	do { \
+		switch ((ctx)->opts.rounds) \
+		{ \
+			case 6: \
+				impl(ctx, __VA_ARGS__, algorithm, 6); \
+				break; \
+			case 9: \
+				impl(ctx, __VA_ARGS__, algorithm, 9); \
+				break; \
+			case 12: \
+				impl(ctx, __VA_ARGS__, algorithm, 12); \
+				break; \
+			default: \
+				impl(ctx, __VA_ARGS__, algorithm, (ctx)->opts.rounds); \
+				break; \
+		} \
+	} while (0)
+
+#define FEISTEL_DISPATCH(impl, ctx, ...) \
+	do { \
+		if ((ctx)->opts.algorithm == PERMUTESEQ_ALGO_MIX) \
+			FEISTEL_DISPATCH_ROUNDS(impl, ctx, PERMUTESEQ_ALGO_MIX, __VA_ARGS__); \
+		else \
+			FEISTEL_DISPATCH_ROUNDS(impl, ctx, PERMUTESEQ_ALGO_JENKINS, __VA_ARGS__); \
+	} while (0)
+
+/*
+ * Run the rounds of the Feistel network over count lanes, whose
+ * left and right half blocks are in the l and r arrays.
+ * direction: 0: encrypt, 1: decrypt
+ */
+typedef void (*feistel_rounds_function) (const CipherContext *ctx,
+					 uint32 *l, uint32 *r,
+					 int count, int direction);
+
+/* Implementation chosen at load time, see permuteseq_simd.c */
+extern feistel_rounds_function feistel_rounds;
+
+extern void feistel_rounds_scalar(const CipherContext *ctx,
+				  uint32 *l, uint32 *r,
+				  int count, int direction);
+
+extern const char *select_feistel_rounds(void);
+
+/*
+ * Counters of the work done by the backend, not yet added to the shared
+ * statistics (see permuteseq_stats()). The first ones are maintained
+ * by the cipher, the others by the caches of the extension.
+ */
+typedef struct PermuteseqStats
+{
+	uint64		calls;		/* values encrypted or decrypted */
+	uint64		walks;		/* passes through the Feistel network */
+	uint64		max_walks;	/* maximum passes for a single value */
+	uint64		table_lookups;	/* values read from lookup tables */
+	uint64		table_builds;	/* lookup tables computed */
+	uint64		context_hits;	/* cipher contexts found in fn_extra */
+	uint64		context_misses;	/* cipher contexts initialized */
+	uint64		bounds_hits;	/* sequences found in the bounds cache */
+	uint64		bounds_misses;	/* sequences looked up in the catalogs */
+	uint64		shared_hits;	/* cipher contexts found in shared memory */
+	uint64		shared_misses;	/* cipher contexts not in shared memory */
+} PermuteseqStats;
+
+extern PermuteseqStats permuteseq_local_stats;
+
+/* Number of values processed together by cycle_walking_cipher_batch() */
+#define CIPHER_CHUNK	256
+
+/* The cipher, see permuteseq_cipher.c */
+extern void cipher_init(CipherContext *ctx,
+			int64 minval, int64 maxval,
+			uint64 crypt_key,
+			const CipherOptions *opts);
+
+extern double cipher_domain_size(const CipherContext *ctx);
+
+extern int64 cipher_encrypt(const CipherContext *ctx, int64 value);
+extern int64 cipher_decrypt(const CipherContext *ctx, int64 value);
+
+extern int64 cycle_walking_cipher(const CipherContext *ctx,
+				  int64 value,
+				  int direction);
+
+extern void cycle_walking_cipher_batch(const CipherContext *ctx,
+				       const int64 *values,
+				       int64 *results,
+				       int count,
+				       int direction);
+
+extern int cipher_passes(const CipherContext *ctx, int64 value, int direction);
+
+/*
+ * Report a cycle walking that doesn't end, which would mean a bug.
+ * Defined by the extension, raising an error, by the benchmark, and by
+ * the C library, which returns PERMUTESEQ_EINTERNAL afterwards.
+ */
+extern void cipher_walk_failed(int64 value, int walk_max);
+
+#endif							/* PERMUTESEQ_H */
@@ -0,0 +1,172 @@
+/*
+ * permuteseq_api.c
+ *
+ * Implementation of the plain C interface of permuteseq_cipher.h over
+ * the cipher of permuteseq_cipher.c, for libpermuteseq_cipher.a.
+ * It's built with FRONTEND defined, outside of the server.
+ *
+ * By Daniel Vérité, 2016-2023. See LICENSE.md
+ */
+
+#include "postgres_fe.h"
+
+#ifndef WIN32
+#include <pthread.h>
+#endif
+
+#include "permuteseq.h"
+#include "permuteseq_cipher.h"
+
+struct PermuteseqCipher
+{
+	CipherContext ctx;
+};
+
+/*
+ * Thread-local storage, for the failures of the walk.
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define api_thread_local _Thread_local
+#elif defined(_MSC_VER)
+#define api_thread_local __declspec(thread)
+#else
+#define api_thread_local __thread
+#endif
+
+static api_thread_local bool walk_failed = false;
+
+/*
+ * The walk never fails unless there's a bug in the cipher. Since it
+ * can't be interrupted in the middle of a permutation, note the failure
+ * for crypt_value() or crypt_batch() to return it to the caller.
+ * This is also what keeps the library free of any output or of the
+ * printing functions of libpgport.
+ */
+void
+cipher_walk_failed(int64 value, int walk_max)
+{
+	(void) value;
+	(void) walk_max;
+	walk_failed = true;
+}
+
+/*
+ * The multi-lane implementation for the CPU is chosen the first time a
+ * cipher is set up, and only then, since feistel_rounds may be in
+ * use by other threads.
+ */
+#ifndef WIN32
+static pthread_once_t rounds_once = PTHREAD_ONCE_INIT;
+
+static void
+select_rounds_once(void)
+{
+	select_feistel_rounds();
+}
+#else
+static INIT_ONCE rounds_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK
+select_rounds_once(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+	select_feistel_rounds();
+	return TRUE;
+}
+#endif
+
+size_t
+permuteseq_cipher_size(void)
+{
+	return sizeof(PermuteseqCipher);
+}
+
+int
+permuteseq_cipher_init(PermuteseqCipher *cipher, int64_t minval, int64_t maxval,
+		       uint64_t crypt_key, int algorithm, int rounds)
+{
+	CipherOptions opts;
+
+	/* same conditions as the SQL functions */
+	if (minval > maxval || (uint64) maxval - (uint64) minval < 3)
+		return PERMUTESEQ_EINVAL;
+	if (algorithm < 1 || algorithm > PERMUTESEQ_ALGO_MAX ||
+	    rounds < PERMUTESEQ_MIN_ROUNDS || rounds > PERMUTESEQ_MAX_ROUNDS)
+		return PERMUTESEQ_EINVAL;
+
+#ifndef WIN32
+	pthread_once(&rounds_once, select_rounds_once);
+#else
+	InitOnceExecuteOnce(&rounds_once, select_rounds_once, NULL, NULL);
+#endif
+
+	opts.algorithm = algorithm;
+	opts.rounds = rounds;
+	cipher_init(&cipher->ctx, minval, maxval, crypt_key, &opts);
+
+	return PERMUTESEQ_OK;
+}
+
+static int
+crypt_value(const PermuteseqCipher *cipher, int64_t value, int64_t *result,
+	    int direction)
+{
+	if (value < cipher->ctx.minval || value > cipher->ctx.maxval)
+		return PERMUTESEQ_ERANGE;
+
+	walk_failed = false;
+	*result = cycle_walking_cipher(&cipher->ctx, value, direction);
+
+	return walk_failed ? PERMUTESEQ_EINTERNAL : PERMUTESEQ_OK;
+}
+
+int
+permuteseq_encrypt(const PermuteseqCipher *cipher, int64_t value, int64_t *result)
+{
+	return crypt_value(cipher, value, result, 0);
+}
+
+int
+permuteseq_decrypt(const PermuteseqCipher *cipher, int64_t value, int64_t *result)
+{
+	return crypt_value(cipher, value, result, 1);
+}
+
+static int
+crypt_batch(const PermuteseqCipher *cipher, const int64_t *values,
+	    int64_t *results, size_t count, int direction)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (values[i] < cipher->ctx.minval || values[i] > cipher->ctx.maxval)
+			return PERMUTESEQ_ERANGE;
+	}
+
+	walk_failed = false;
+
+	/* the cipher takes an int count, CIPHER_CHUNK values at a time */
+	for (i = 0; i < count && !walk_failed; i += CIPHER_CHUNK)
+	{
+		int n = (int) Min(CIPHER_CHUNK, count - i);
+
+		cycle_walking_cipher_batch(&cipher->ctx, (const int64 *) values + i,
+					   (int64 *) results + i, n, direction);
+	}
+
+	return walk_failed ? PERMUTESEQ_EINTERNAL : PERMUTESEQ_OK;
+}
+
+int
+permuteseq_encrypt_batch(const PermuteseqCipher *cipher, const int64_t *values,
+			 int64_t *results, size_t count)
+{
+	return crypt_batch(cipher, values, results, count, 0);
+}
+
+int
+permuteseq_decrypt_batch(const PermuteseqCipher *cipher, const int64_t *values,
+			 int64_t *results, size_t count)
+{
+	return crypt_batch(cipher, values, results, count, 1);
+}
@@ -0,0 +1,887 @@
+/*
+ * permuteseq_cipher.c
+ *
+ * The cipher itself: Feistel networks with cycle walking, permuting
+ * values inside an interval.
+ * This file doesn't depend on the server, except for the walking error
+ * (see cipher_walk_failed()), so that it can be built with FRONTEND
+ * defined into the benchmark program (see bench/).
+ *
+ * By Daniel Vérité, 2016-2023. See LICENSE.md
+ */
+
+#include <math.h>
+
+#ifdef FRONTEND
+#include "postgres_fe.h"
+#define CHECK_FOR_INTERRUPTS()	((void) 0)
+#else
+#include "postgres.h"
+#include "miscadmin.h"
+#endif
+
+#include "permuteseq.h"
+
+/*
+ * The statistics are only kept in the server. Outside of it, the cipher
+ * may be used by concurrent threads (see permuteseq_api.c).
+ */
+#ifdef FRONTEND
+#define count_stat(field, n)	((void) 0)
+#define count_max_walks(passes)	((void) 0)
+#else
+PermuteseqStats permuteseq_local_stats;
+
+#define count_stat(field, n)	(permuteseq_local_stats.field += (n))
+#define count_max_walks(passes) \
+	do { \
+		if ((uint64) (passes) > permuteseq_local_stats.max_walks) \
+			permuteseq_local_stats.max_walks = (passes); \
+	} while (0)
+#endif
+
+/*
+ * Count a value encrypted or decrypted in the given number of passes.
+ */
+static inline void
+count_passes(int passes)
+{
+	count_stat(calls, 1);
+	count_stat(walks, passes);
+	count_max_walks(passes);
+}
+
+/*
+ * Arithmetic modulo n for the affine permutations of
+ * PERMUTESEQ_ALGO_AFFINE, n being the size of the interval, or 0 for
+ * the full int64 range of 2^64 values, for which it's the native
+ * unsigned arithmetic. The operands are less than n.
+ */
+static inline uint64
+affine_addmod(uint64 a, uint64 b, uint64 n)
+{
+	if (n == 0)
+		return a + b;
+	return (a >= n - b) ? a - (n - b) : a + b;
+}
+
+static inline uint64
+affine_submod(uint64 a, uint64 b, uint64 n)
+{
+	if (n == 0)
+		return a - b;
+	return (a >= b) ? a - b : a + (n - b);
+}
+
+static inline uint64
+affine_mulmod(uint64 a, uint64 b, uint64 n)
+{
+	if (n == 0)
+		return a * b;
+	/* the product of two numbers below 2^32 fits in 64 bits */
+	if (n <= (uint64) 1 << 32)
+		return (a * b) % n;
+#ifdef HAVE_INT128
+	return (uint64) (((uint128) a * b) % n);
+#else
+	{
+		uint64 result = 0;
+
+		while (b != 0)
+		{
+			if (b & 1)
+				result = affine_addmod(result, a, n);
+			a = affine_addmod(a, a, n);
+			b >>= 1;
+		}
+		return result;
+	}
+#endif
+}
+
+static uint64
+affine_gcd(uint64 a, uint64 b)
+{
+	while (b != 0)
+	{
+		uint64 t = a % b;
+
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/*
+ * Inverse of m modulo n, m being coprime with n.
+ */
+static uint64
+affine_inverse(uint64 m, uint64 n)
+{
+	uint64 r0, r1, t0, t1;
+
+	if (n == 0)
+	{
+		/* m is odd. Newton's iteration doubles the number of correct
+		   low-order bits of the inverse, starting with 3 for m itself. */
+		uint64 inv = m;
+		int i;
+
+		for (i = 0; i < 5; i++)
+			inv *= 2 - m * inv;
+		return inv;
+	}
+
+	/* extended Euclid, with the coefficients of m kept modulo n */
+	r0 = n;
+	r1 = m;
+	t0 = 0;
+	t1 = 1;
+	while (r1 != 0)
+	{
+		uint64 q = r0 / r1;
+		uint64 t;
+
+		t = r0 - q * r1;
+		r0 = r1;
+		r1 = t;
+		t = affine_submod(t0, affine_mulmod(q % n, t1, n), n);
+		t0 = t1;
+		t1 = t;
+	}
+	return t0;
+}
+
+/*
+ * Set up the affine permutations of PERMUTESEQ_ALGO_AFFINE modulo n
+ * (0 for 2^64), with multipliers and increments derived from the
+ * scrambled key, and the multipliers coprime with n.
+ */
+static void
+affine_init(CipherContext *ctx, uint64 n, uint64 scrambled_key)
+{
+	int j;
+
+	for (j = 0; j < 2; j++)
+	{
+		uint32 lo = (uint32) scrambled_key;
+		uint32 hi = (uint32) (scrambled_key >> 32);
+		uint32 tweak = 0x2545f491 + 4 * j;
+		uint64 mul = ((uint64) feistel_hash(hi ^ tweak) << 32) | feistel_hash(lo ^ (tweak + 1));
+		uint64 add = ((uint64) feistel_hash(hi ^ (tweak + 2)) << 32) | feistel_hash(lo ^ (tweak + 3));
+
+		if (n == 0)
+			mul |= 1;
+		else
+		{
+			mul %= n;
+			add %= n;
+			while (mul == 0 || affine_gcd(mul, n) != 1)
+				mul = (mul + 1 == n) ? 1 : mul + 1;
+		}
+
+		ctx->affine_mul[j] = mul;
+		ctx->affine_inv[j] = affine_inverse(mul, n);
+		ctx->affine_add[j] = add;
+	}
+}
+
+/*
+ * Set up the cipher for values in [minval,maxval] and the given key.
+ */
+void
+cipher_init(CipherContext *ctx, int64 minval, int64 maxval, uint64 crypt_key,
+	    const CipherOptions *opts)
+{
+	/* Number of possible values for the output, minus 1. The interval
+	   itself doesn't fit in 64 bits when it spans all int64 values. */
+	uint64 max_offset = (uint64) maxval - (uint64) minval;
+	unsigned int hsz;
+	uint64 scrambled_key;
+	uint32 Ki;
+	int i;
+
+	ctx->minval = minval;
+	ctx->maxval = maxval;
+	ctx->crypt_key = crypt_key;
+	ctx->max_offset = max_offset;
+	ctx->opts = *opts;
+	ctx->lut_encrypt = NULL;
+	ctx->lut_decrypt = NULL;
+	ctx->lut_slot = -1;
+	ctx->lut_generation = 0;
+
+	/* Compute the half block size: it's the smallest power of 2 such as two
+	   blocks are greater than or equal to the size of interval in bits. The
+	   half-blocks have equal lengths. */
+	hsz = 1;
+	while (hsz < 32 && ((uint64)1<<(2*hsz)) - 1 < max_offset)
+		hsz++;
+
+	ctx->hsz = hsz;
+	ctx->mask = (uint32) (((uint64)1 << hsz) - 1);
+
+	/* For the modular network, the radices are a=ceil(sqrt(interval))
+	   and b=ceil(interval/a), so that a*b is less than interval+a.
+	   Both fit in 32 bits. */
+	if (opts->algorithm == PERMUTESEQ_ALGO_MODULAR)
+	{
+		uint64 n = max_offset;
+		uint64 root = (uint64) sqrt((double) n);
+
+		/* adjust the floating-point approximation of floor(sqrt(n)) */
+		if (root > PG_UINT32_MAX)
+			root = PG_UINT32_MAX;
+		while (root * root > n)
+			root--;
+		while (root < PG_UINT32_MAX && (root + 1) * (root + 1) <= n)
+			root++;
+
+		ctx->radix_a = root + 1;
+		ctx->radix_b = n / ctx->radix_a + 1;
+		ctx->upper_window = 0;
+	}
+	else if (opts->algorithm == PERMUTESEQ_ALGO_BOUNDED ||
+		 opts->algorithm == PERMUTESEQ_ALGO_AFFINE)
+	{
+		/* The radices are a=floor(sqrt(interval)) and b=floor(interval/a),
+		   capped to 2^32 so that the halves fit in 32 bits, and the upper
+		   window starts at interval-a*b. The full int64 range, whose size
+		   doesn't fit in 64 bits, is exactly 2^32*2^32. */
+		if (max_offset == PG_UINT64_MAX)
+		{
+			ctx->radix_a = (uint64) 1 << 32;
+			ctx->radix_b = (uint64) 1 << 32;
+			ctx->upper_window = 0;
+		}
+		else
+		{
+			uint64 n = max_offset + 1;
+			uint64 root = (uint64) sqrt((double) n);
+
+			if (root > PG_UINT32_MAX)
+				root = PG_UINT32_MAX;
+			while (root * root > n)
+				root--;
+			while (root < PG_UINT32_MAX && (root + 1) * (root + 1) <= n)
+				root++;
+
+			ctx->radix_a = root;
+			ctx->radix_b = Min(n / root, (uint64) 1 << 32);
+			ctx->upper_window = n - ctx->radix_a * ctx->radix_b;
+		}
+	}
+	else
+	{
+		ctx->radix_a = 0;
+		ctx->radix_b = 0;
+		ctx->upper_window = 0;
+	}
+
+	/* Scramble the key. This is not strictly necessary, but will
+	   help if the user-supplied key is weak, for instance with only a
+	   few right-most bits set. */
+	scrambled_key = feistel_hash(crypt_key & 0xffffffff) |
+		((uint64)feistel_hash((crypt_key >> 32) & 0xffffffff)) << 32;
+
+	/* The subkey Ki for the round i is a sliding and cycling window
+	   of hsz bits over K, moving left to right, so each round takes
+	   different bits out of the crypt key.
+	   Only its hash is used by the round function, so it's computed
+	   here once for all. */
+	for (i = 0; i < opts->rounds; i++)
+	{
+		Ki = scrambled_key >> ((hsz*i)&0x3f);
+		Ki += i;
+		ctx->round_keys[i] = feistel_hash(Ki);
+	}
+
+	if (opts->algorithm == PERMUTESEQ_ALGO_AFFINE)
+		affine_init(ctx, max_offset + 1, scrambled_key);
+	else
+	{
+		memset(ctx->affine_mul, 0, sizeof(ctx->affine_mul));
+		memset(ctx->affine_inv, 0, sizeof(ctx->affine_inv));
+		memset(ctx->affine_add, 0, sizeof(ctx->affine_add));
+	}
+}
+
+/*
+ * Feistel network with cycle walking loop to produce a encrypted or
+ * decrypted result between minval and maxval, into *output.
+ * It's called through FEISTEL_DISPATCH() by cycle_walking_cipher(), with
+ * constant algorithm and nr (number of rounds) for the common cases.
+ *
+ * direction: 0: encrypt, 1: decrypt
+ */
+static pg_attribute_always_inline void
+cycle_walking_cipher_impl(const CipherContext *ctx, int64 value, int direction,
+			  int64 *output, int algorithm, int nr)
+{
+	/* Arbitrary maximum number of "walks" along the results
+	   searching for a value inside the [minval,maxval] range.
+	   It's mainly to avoid an infinite loop in case the chain of
+	   results has a cycle (which would imply a bug somewhere). */
+	const int walk_max = 1000000;
+
+	/* Half block size */
+	unsigned int hsz = ctx->hsz;
+	uint32 mask = ctx->mask;
+	const uint32 *round_keys = ctx->round_keys;
+	int64 minval = ctx->minval;
+	uint64 max_offset = ctx->max_offset;
+
+	uint32 l1, r1, l2, r2;
+	int walk_count = 0;
+	int i;
+	uint64 result;		/* offset into the interval */
+
+	/* Initialize the two half blocks.
+	   Work with the offset into the interval rather than the actual value.
+	   This allows to use the full 32-bit range. The offset is computed
+	   in unsigned arithmetic, since it may not fit in an int64. */
+	result = (uint64) value - (uint64) minval;
+	l1 = result >> hsz;
+	r1 = result & mask;
+
+	do			/* cycle walking */
+	{
+		for (i = 0; i < nr; i++) /* Feistel network */
+		{
+			l2 = r1;
+			/* The round function is hash(Ri) XOR hash(Ki) for the
+			   original algorithm (see feistel_round_function()).
+			   When decrypting, Ki corresponds to the Kj of encryption with
+			   j=(nr-1-i), i.e. we iterate over subkeys in the reverse order. */
+			r2 = (l1 ^ feistel_round_function(algorithm, r1,
+							  round_keys[direction==0 ? i : nr-1-i])
+			      ) & mask;
+			l1 = l2;
+			r1 = r2;
+		}
+		result = ((uint64)r1 << hsz) | l1;
+		/* swap one more time to prepare for the next cycle */
+		l2 = l1;
+		l1 = r1;
+		r1 = l2;
+	} while ((result > max_offset) && walk_count++ < walk_max);
+
+	if (walk_count >= walk_max)
+	{
+		cipher_walk_failed(value, walk_max);
+	}
+
+	count_passes(walk_count + 1);
+
+	/* Convert the offset in the interval to an absolute value, possibly negative. */
+	*output = (int64) ((uint64) minval + result);
+}
+
+/*
+ * Map x from [0,2^32) into [0,radix), radix being at most 2^32.
+ */
+static inline uint64
+feistel_scale(uint32 x, uint64 radix)
+{
+	return ((uint64) x * radix) >> 32;
+}
+
+/*
+ * Modular Feistel network of PERMUTESEQ_ALGO_MODULAR and
+ * PERMUTESEQ_ALGO_BOUNDED, permuting [0,a*b) where a and b are
+ * the radices of the context.
+ * An offset x is split into (L,R) = (x/b, x%b), L being a digit in
+ * radix a and R in radix b.
+ * The round i maps (L,R) to (R, (L + F(R,Ki)) mod a), so
+ * the radices of the halves are swapped at each round, and if
+ * the number of rounds is odd, the output is L*a+R instead of L*b+R.
+ * F(R,Ki) is the 32-bit round function scaled into [0,a) with a
+ * multiplication instead of a division (see feistel_scale()), and since
+ * L is also less than a, the modulo is only a conditional subtraction.
+ * tweak is XOR'ed into the round keys, so that the same context provides
+ * independent permutations, 0 giving the permutation of the key.
+ */
+static pg_attribute_always_inline uint64
+modular_feistel_network(const CipherContext *ctx, uint64 x, int direction,
+			uint32 tweak, int algorithm, int nr)
+{
+	const uint32 *round_keys = ctx->round_keys;
+	/* radices of the halves at the start of the encryption and at its end */
+	uint64 in_radix_b = ctx->radix_b;
+	uint64 out_radix_b = (nr % 2 == 0) ? ctx->radix_b : ctx->radix_a;
+	uint32 l, r;
+	uint64 p, q;	/* current radices of l and r */
+	int i;
+
+	if (direction == 0)
+	{
+		p = ctx->radix_a;
+		q = in_radix_b;
+		l = x / q;
+		r = x % q;
+		for (i = 0; i < nr; i++)
+		{
+			uint64 t = (uint64) l +
+				feistel_scale(feistel_round_function(algorithm, r, round_keys[i] ^ tweak), p);
+
+			if (t >= p)
+				t -= p;
+
+			l = r;
+			r = (uint32) t;
+			t = p;
+			p = q;
+			q = t;
+		}
+	}
+	else
+	{
+		/* p,q are the radices of the halves after the rounds */
+		q = out_radix_b;
+		p = (q == ctx->radix_a) ? ctx->radix_b : ctx->radix_a;
+		l = x / q;
+		r = x % q;
+		for (i = nr - 1; i >= 0; i--)
+		{
+			/* undo the round i: the previous left half was in radix q */
+			uint64 f = feistel_scale(feistel_round_function(algorithm, l, round_keys[i] ^ tweak), q);
+			uint64 t = (uint64) r + q - f;
+
+			if (t >= q)
+				t -= q;
+
+			r = l;
+			l = (uint32) t;
+			t = p;
+			p = q;
+			q = t;
+		}
+	}
+	return (uint64) l * q + r;
+}
+
+/*
+ * Same as cycle_walking_cipher_impl() for PERMUTESEQ_ALGO_MODULAR,
+ * cycle-walking the permutation of [0,a*b) by the modular network.
+ */
+static pg_attribute_always_inline void
+modular_cycle_walking_cipher_impl(const CipherContext *ctx, int64 value, int direction,
+				  int64 *output, int algorithm, int nr)
+{
+	const int walk_max = 1000000;
+	int64 minval = ctx->minval;
+	uint64 max_offset = ctx->max_offset;
+	uint64 result = (uint64) value - (uint64) minval;
+	int walk_count = 0;
+
+	do			/* cycle walking */
+	{
+		result = modular_feistel_network(ctx, result, direction, 0, algorithm, nr);
+	} while ((result > max_offset) && walk_count++ < walk_max);
+
+	if (walk_count >= walk_max)
+	{
+		cipher_walk_failed(value, walk_max);
+	}
+
+	count_passes(walk_count + 1);
+
+	*output = (int64) ((uint64) minval + result);
+}
+
+/*
+ * Tweak of the round keys for the permutation of the upper window
+ * of PERMUTESEQ_ALGO_BOUNDED.
+ */
+#define BOUNDED_UPPER_TWEAK	0x5bd1e995
+
+/*
+ * Same as cycle_walking_cipher_impl() for PERMUTESEQ_ALGO_BOUNDED,
+ * without cycle walking.
+ * The radices a and b are such that M=a*b is the largest product not
+ * above the size N of the interval, with a=floor(sqrt(N)), so that N-M
+ * is less than 2*sqrt(N) and in particular M is more than N/2.
+ * The lower window [0,M) and the upper window [N-M,N) of offsets then
+ * overlap and cover the interval. The modular network permutes each of
+ * them exactly, so that applying the permutation of the lower window to
+ * the offsets inside it, then the permutation of the upper window (with
+ * other round keys) to the results inside it, makes a permutation
+ * of [0,N). Every value takes one or two passes through the network,
+ * instead of a number of passes that is small on average but not bounded.
+ * When N is a product of two radices, the windows are the same and there
+ * is a single pass.
+ */
+static pg_attribute_always_inline void
+bounded_cipher_impl(const CipherContext *ctx, int64 value, int direction,
+		    int64 *output, int algorithm, int nr)
+{
+	int64 minval = ctx->minval;
+	uint64 upper_start = ctx->upper_window;		/* N-M */
+	uint64 lower_last = ctx->max_offset - upper_start;	/* M-1 */
+	uint64 result = (uint64) value - (uint64) minval;
+	int passes = 0;
+
+	if (direction == 0)
+	{
+		if (result <= lower_last)
+		{
+			result = modular_feistel_network(ctx, result, 0, 0, algorithm, nr);
+			passes++;
+		}
+		if (upper_start > 0 && result >= upper_start)
+		{
+			result = upper_start + modular_feistel_network(ctx, result - upper_start, 0,
+								       BOUNDED_UPPER_TWEAK, algorithm, nr);
+			passes++;
+		}
+	}
+	else
+	{
+		if (upper_start > 0 && result >= upper_start)
+		{
+			result = upper_start + modular_feistel_network(ctx, result - upper_start, 1,
+								       BOUNDED_UPPER_TWEAK, algorithm, nr);
+			passes++;
+		}
+		if (result <= lower_last)
+		{
+			result = modular_feistel_network(ctx, result, 1, 0, algorithm, nr);
+			passes++;
+		}
+	}
+
+	count_passes(passes);
+
+	*output = (int64) ((uint64) minval + result);
+}
+
+/*
+ * Same as cycle_walking_cipher_impl() for PERMUTESEQ_ALGO_AFFINE,
+ * without cycle walking: the offset goes through a first affine
+ * permutation modulo the size N of the interval, then through the
+ * permutation of the lower window [0,a*b) of PERMUTESEQ_ALGO_BOUNDED if
+ * it's inside it, then through a second affine permutation, which
+ * spreads the values above the window that the network doesn't move.
+ * The affine permutations alone would keep the differences between
+ * values, and the network alone would leave the upper values in place.
+ */
+static pg_attribute_always_inline void
+affine_cipher_impl(const CipherContext *ctx, int64 value, int direction,
+		   int64 *output, int algorithm, int nr)
+{
+	int64 minval = ctx->minval;
+	uint64 n = ctx->max_offset + 1;		/* 0 for 2^64 */
+	uint64 lower_last = ctx->max_offset - ctx->upper_window;	/* a*b-1 */
+	uint64 result = (uint64) value - (uint64) minval;
+	int passes = 0;
+
+	if (direction == 0)
+	{
+		result = affine_addmod(affine_mulmod(result, ctx->affine_mul[0], n),
+				       ctx->affine_add[0], n);
+		if (result <= lower_last)
+		{
+			result = modular_feistel_network(ctx, result, 0, 0, algorithm, nr);
+			passes++;
+		}
+		result = affine_addmod(affine_mulmod(result, ctx->affine_mul[1], n),
+				       ctx->affine_add[1], n);
+	}
+	else
+	{
+		result = affine_mulmod(affine_submod(result, ctx->affine_add[1], n),
+				       ctx->affine_inv[1], n);
+		if (result <= lower_last)
+		{
+			result = modular_feistel_network(ctx, result, 1, 0, algorithm, nr);
+			passes++;
+		}
+		result = affine_mulmod(affine_submod(result, ctx->affine_add[0], n),
+				       ctx->affine_inv[0], n);
+	}
+
+	count_passes(passes);
+
+	*output = (int64) ((uint64) minval + result);
+}
+
+/*
+ * Call the implementation of the algorithm of ctx with a constant
+ * direction, besides the constant algorithm and number of rounds
+ * of FEISTEL_DISPATCH(), so that the encryption and the decryption
+ * are compiled separately, without tests on the direction in the rounds.
+ */
+#define CIPHER_DISPATCH(ctx, value, direction, output) \
+	do { \
+		if ((ctx)->opts.algorithm == PERMUTESEQ_ALGO_MODULAR) \
+			FEISTEL_DISPATCH_ROUNDS(modular_cycle_walking_cipher_impl, ctx, \
+						PERMUTESEQ_ALGO_MODULAR, value, direction, output); \
+		else if ((ctx)->opts.algorithm == PERMUTESEQ_ALGO_BOUNDED) \
+			FEISTEL_DISPATCH_ROUNDS(bounded_cipher_impl, ctx, \
+						PERMUTESEQ_ALGO_BOUNDED, value, direction, output); \
+		else if ((ctx)->opts.algorithm == PERMUTESEQ_ALGO_AFFINE) \
+			FEISTEL_DISPATCH_ROUNDS(affine_cipher_impl, ctx, \
+						PERMUTESEQ_ALGO_AFFINE, value, direction, output); \
+		else \
+			FEISTEL_DISPATCH(cycle_walking_cipher_impl, ctx, value, direction, output); \
+	} while (0)
+
+/*
+ * Encrypt a value of the interval of ctx.
+ */
+int64
+cipher_encrypt(const CipherContext *ctx, int64 value)
+{
+	int64 result;
+
+	if (ctx->lut_encrypt != NULL)
+	{
+		count_stat(calls, 1);
+		count_stat(table_lookups, 1);
+		return ctx->minval + ctx->lut_encrypt[value - ctx->minval];
+	}
+
+	CIPHER_DISPATCH(ctx, value, 0, &result);
+
+	return result;
+}
+
+/*
+ * Decrypt a value of the interval of ctx.
+ */
+int64
+cipher_decrypt(const CipherContext *ctx, int64 value)
+{
+	int64 result;
+
+	if (ctx->lut_decrypt != NULL)
+	{
+		count_stat(calls, 1);
+		count_stat(table_lookups, 1);
+		return ctx->minval + ctx->lut_decrypt[value - ctx->minval];
+	}
+
+	CIPHER_DISPATCH(ctx, value, 1, &result);
+
+	return result;
+}
+
+/*
+ * direction: 0: encrypt, 1: decrypt
+ */
+int64
+cycle_walking_cipher(const CipherContext *ctx, int64 value, int direction)
+{
+	if (direction == 0)
+		return cipher_encrypt(ctx, value);
+	else
+		return cipher_decrypt(ctx, value);
+}
+
+/*
+ * Number of elements permuted by the Feistel network, of which the
+ * interval is a subset. For PERMUTESEQ_ALGO_BOUNDED, it's the total
+ * size of the windows, each value being in the first window either
+ * before or after its permutation as many times as it is permuted.
+ * For PERMUTESEQ_ALGO_AFFINE, it's the size of the single window, since
+ * values go at most once through the network.
+ */
+double
+cipher_domain_size(const CipherContext *ctx)
+{
+	if (ctx->opts.algorithm == PERMUTESEQ_ALGO_MODULAR)
+		return (double) ctx->radix_a * (double) ctx->radix_b;
+	else if (ctx->opts.algorithm == PERMUTESEQ_ALGO_BOUNDED)
+		return (double) ctx->radix_a * (double) ctx->radix_b *
+			(ctx->upper_window > 0 ? 2 : 1);
+	else if (ctx->opts.algorithm == PERMUTESEQ_ALGO_AFFINE)
+		return (double) ctx->radix_a * (double) ctx->radix_b;
+	else
+		return ldexp(1.0, 2 * ctx->hsz);
+}
+
+/*
+ * Number of passes through the Feistel network taken by
+ * cycle_walking_cipher() for value, for the benchmark. The passes are
+ * run again here, one at a time, rather than counted by the cipher.
+ */
+int
+cipher_passes(const CipherContext *ctx, int64 value, int direction)
+{
+	uint64 offset = (uint64) value - (uint64) ctx->minval;
+	int passes = 0;
+
+	if (ctx->opts.algorithm == PERMUTESEQ_ALGO_BOUNDED)
+	{
+		uint64 upper_start = ctx->upper_window;
+		uint64 lower_last = ctx->max_offset - upper_start;
+		uint64 first_window = (direction == 0) ? 0 : upper_start;
+
+		/* same windows as bounded_cipher_impl(), in the order of direction */
+		if (offset >= first_window && offset <= first_window + lower_last)
+		{
+			offset = first_window +
+				modular_feistel_network(ctx, offset - first_window, direction,
+							first_window != 0 ? BOUNDED_UPPER_TWEAK : 0,
+							ctx->opts.algorithm, ctx->opts.rounds);
+			passes++;
+		}
+		if (upper_start > 0)
+		{
+			uint64 second_window = upper_start - first_window;
+
+			if (offset >= second_window && offset <= second_window + lower_last)
+				passes++;
+		}
+		return passes;
+	}
+
+	if (ctx->opts.algorithm == PERMUTESEQ_ALGO_AFFINE)
+	{
+		uint64 n = ctx->max_offset + 1;
+		int j = (direction == 0) ? 0 : 1;
+
+		/* the offset entering the network, as in affine_cipher_impl() */
+		if (direction == 0)
+			offset = affine_addmod(affine_mulmod(offset, ctx->affine_mul[j], n),
+					       ctx->affine_add[j], n);
+		else
+			offset = affine_mulmod(affine_submod(offset, ctx->affine_add[j], n),
+					       ctx->affine_inv[j], n);
+		return (offset <= ctx->max_offset - ctx->upper_window) ? 1 : 0;
+	}
+
+	do
+	{
+		if (ctx->opts.algorithm == PERMUTESEQ_ALGO_MODULAR)
+			offset = modular_feistel_network(ctx, offset, direction, 0,
+							 ctx->opts.algorithm, ctx->opts.rounds);
+		else
+		{
+			uint32 l = offset >> ctx->hsz;
+			uint32 r = offset & ctx->mask;
+
+			feistel_rounds_scalar(ctx, &l, &r, 1, direction);
+			offset = ((uint64) r << ctx->hsz) | l;
+		}
+		passes++;
+	} while (offset > ctx->max_offset);
+
+	return passes;
+}
+
+/*
+ * Multi-lane version of cycle_walking_cipher(), encrypting or decrypting
+ * count values into results (which may be the same array as values).
+ * The values are processed in chunks of CIPHER_CHUNK, with each pass of
+ * cycle walking running the Feistel network over all the pending values
+ * of the chunk at once, through the vectorized feistel_rounds() when
+ * available.
+ * After each pass, the values whose result is inside the interval are
+ * output and the others are compacted at the front of the chunk, so
+ * that the next pass runs only over them instead of stalling the lanes
+ * that are already done.
+ */
+
+void
+cycle_walking_cipher_batch(const CipherContext *ctx,
+			   const int64 *values,
+			   int64 *results,
+			   int count,
+			   int direction)
+{
+	const int walk_max = 1000000;
+	unsigned int hsz = ctx->hsz;
+	uint32 mask = ctx->mask;
+	int64 minval = ctx->minval;
+	uint64 max_offset = ctx->max_offset;
+	uint32 l[CIPHER_CHUNK], r[CIPHER_CHUNK];
+	int idx[CIPHER_CHUNK];				/* index into values/results */
+	int base;
+
+	if (ctx->lut_encrypt != NULL)
+	{
+		const uint32 *table = (direction == 0) ? ctx->lut_encrypt : ctx->lut_decrypt;
+
+		for (base = 0; base < count; base++)
+			results[base] = minval + table[values[base] - minval];
+		count_stat(calls, count);
+		count_stat(table_lookups, count);
+		return;
+	}
+
+	/* The modular network has no multi-lane implementation, but it
+	   needs about one pass per value anyway. */
+	if (ctx->opts.algorithm == PERMUTESEQ_ALGO_MODULAR ||
+	    ctx->opts.algorithm == PERMUTESEQ_ALGO_BOUNDED ||
+	    ctx->opts.algorithm == PERMUTESEQ_ALGO_AFFINE)
+	{
+		for (base = 0; base < count; base++)
+		{
+			if (base % CIPHER_CHUNK == 0)
+				CHECK_FOR_INTERRUPTS();
+			results[base] = cycle_walking_cipher(ctx, values[base], direction);
+		}
+		return;
+	}
+
+	for (base = 0; base < count; base += CIPHER_CHUNK)
+	{
+		int pending = Min(CIPHER_CHUNK, count - base);
+		int walk_count = 0;
+		int j;
+
+		CHECK_FOR_INTERRUPTS();
+
+		count_stat(calls, pending);
+
+		for (j = 0; j < pending; j++)
+		{
+			uint64 off = (uint64) values[base + j] - (uint64) minval;
+
+			l[j] = off >> hsz;
+			r[j] = off & mask;
+			idx[j] = base + j;
+		}
+
+		for (;;)		/* cycle walking */
+		{
+			int npending = 0;
+
+			feistel_rounds(ctx, l, r, pending, direction);
+			count_stat(walks, pending);
+
+			for (j = 0; j < pending; j++)
+			{
+				uint64 offset = ((uint64)r[j] << hsz) | l[j];
+
+				if (offset <= max_offset)
+					results[idx[j]] = (int64) ((uint64) minval + offset);
+				else
+				{
+					/* swap to prepare for the next cycle */
+					uint32 t = l[j];
+
+					l[npending] = r[j];
+					r[npending] = t;
+					idx[npending] = idx[j];
+					npending++;
+				}
+			}
+
+			pending = npending;
+			if (pending == 0)
+			{
+				count_max_walks(walk_count + 1);
+				break;
+			}
+
+			if (walk_count++ >= walk_max)
+			{
+				/* the library returns from it with an error code */
+				cipher_walk_failed(values[idx[0]], walk_max);
+				return;
+			}
+		}
+	}
+}
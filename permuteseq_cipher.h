@@ -0,0 +1,81 @@
+/*
+ * permuteseq_cipher.h
+ *
+ * Plain C interface to the cipher of permuteseq, for programs and
+ * other extensions producing or decoding the same values as the SQL
+ * functions without going through the server: the result of
+ * permuteseq_encrypt() with a given range, key, algorithm and number
+ * of rounds is the result of range_encrypt_element() with the same
+ * arguments.
+ *
+ * It only depends on the C standard headers. The implementation is in
+ * libpermuteseq_cipher.a ("make lib"), which is compiled with the
+ * headers of the server but doesn't need any of its libraries.
+ *
+ * By Daniel Vérité, 2016-2023. See LICENSE.md
+ */
+
+#ifndef PERMUTESEQ_CIPHER_H
+#define PERMUTESEQ_CIPHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Return codes */
+#define PERMUTESEQ_OK		0
+#define PERMUTESEQ_EINVAL	(-1)	/* invalid range, algorithm or rounds */
+#define PERMUTESEQ_ERANGE	(-2)	/* value outside of the range */
+#define PERMUTESEQ_EINTERNAL	(-3)	/* cycle walking not ending, a bug */
+
+/* Defaults of the SQL functions */
+#define PERMUTESEQ_CIPHER_DEFAULT_ALGORITHM	1
+#define PERMUTESEQ_CIPHER_DEFAULT_ROUNDS	9
+
+/*
+ * State of the cipher for a range and key, set up once by
+ * permuteseq_cipher_init() into permuteseq_cipher_size() bytes
+ * allocated by the caller, and then usable concurrently by any
+ * number of threads. It contains no pointer to other memory and
+ * needs no cleanup.
+ */
+typedef struct PermuteseqCipher PermuteseqCipher;
+
+extern size_t permuteseq_cipher_size(void);
+
+/*
+ * Set up the cipher for the values in [minval,maxval], which must
+ * contain at least 4 values, with the given key, algorithm (1 to 5)
+ * and number of rounds (3 to 32).
+ */
+extern int permuteseq_cipher_init(PermuteseqCipher *cipher,
+				  int64_t minval, int64_t maxval,
+				  uint64_t crypt_key,
+				  int algorithm, int rounds);
+
+/* Encrypt or decrypt a value of the range into *result */
+extern int permuteseq_encrypt(const PermuteseqCipher *cipher,
+			      int64_t value, int64_t *result);
+extern int permuteseq_decrypt(const PermuteseqCipher *cipher,
+			      int64_t value, int64_t *result);
+
+/*
+ * Encrypt or decrypt count values into results, which may be the same
+ * array as values. Nothing is output if a value is outside of the range.
+ * With PERMUTESEQ_EINTERNAL, the contents of results are undefined.
+ */
+extern int permuteseq_encrypt_batch(const PermuteseqCipher *cipher,
+				    const int64_t *values, int64_t *results,
+				    size_t count);
+extern int permuteseq_decrypt_batch(const PermuteseqCipher *cipher,
+				    const int64_t *values, int64_t *results,
+				    size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif							/* PERMUTESEQ_CIPHER_H */
@@ -0,0 +1,366 @@
+/*
+ * permuteseq_simd.c
+ *
+ * Multi-lane implementations of the rounds of the Feistel network,
+ * used by the batch functions. The vector versions run the rounds over
+ * 16 (AVX-512), 8 (AVX2) or 4 (NEON) values at once, with the same
+ * results as the scalar version.
+ * The implementation is chosen at load time depending on the CPU.
+ *
+ * By Daniel Vérité, 2016-2023. See LICENSE.md
+ */
+
+#ifdef FRONTEND
+#include "postgres_fe.h"
+#else
+#include "postgres.h"
+#endif
+
+#include "permuteseq.h"
+
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 6))
+#define USE_AVX2_FEISTEL
+#define USE_AVX512_FEISTEL
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define USE_NEON_FEISTEL
+#include <arm_neon.h>
+#endif
+
+feistel_rounds_function feistel_rounds = feistel_rounds_scalar;
+
+/*
+ * Get the round keys in the order in which the rounds use them.
+ * When decrypting, Ki corresponds to the Kj of encryption with
+ * j=(nr-1-i), i.e. we iterate over subkeys in the reverse order.
+ */
+static inline void
+get_round_keys(const CipherContext *ctx, int direction, int nr, uint32 *rk)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		rk[i] = ctx->round_keys[direction==0 ? i : nr-1-i];
+}
+
+/*
+ * The implementations are written as inline functions taking the
+ * algorithm and the number of rounds as arguments, which are then called
+ * through FEISTEL_DISPATCH() with constants, so that the compiler
+ * produces specialized loops for each round function and the common
+ * numbers of rounds.
+ */
+static pg_attribute_always_inline void
+feistel_rounds_scalar_impl(const CipherContext *ctx, uint32 *l, uint32 *r,
+			   int count, int direction, int algorithm, int nr)
+{
+	uint32 rk[PERMUTESEQ_MAX_ROUNDS];
+	uint32 mask = ctx->mask;
+	int i, j;
+
+	get_round_keys(ctx, direction, nr, rk);
+
+	for (j = 0; j < count; j++)
+	{
+		uint32 l1 = l[j], r1 = r[j], r2;
+
+		for (i = 0; i < nr; i++)
+		{
+			r2 = (l1 ^ feistel_round_function(algorithm, r1, rk[i])) & mask;
+			l1 = r1;
+			r1 = r2;
+		}
+		l[j] = l1;
+		r[j] = r1;
+	}
+}
+
+void
+feistel_rounds_scalar(const CipherContext *ctx, uint32 *l, uint32 *r,
+		      int count, int direction)
+{
+	FEISTEL_DISPATCH(feistel_rounds_scalar_impl, ctx, l, r, count, direction);
+}
+
+#ifdef USE_AVX2_FEISTEL
+
+#define AVX2_ROT(x,k) \
+	_mm256_or_si256(_mm256_slli_epi32((x), (k)), _mm256_srli_epi32((x), 32-(k)))
+
+__attribute__((target("avx2")))
+static inline __m256i
+feistel_hash_avx2(__m256i k)
+{
+	__m256i a, b, c;
+
+	a = b = c = _mm256_set1_epi32(FEISTEL_HASH_INIT);
+	a = _mm256_add_epi32(a, k);
+
+	c = _mm256_xor_si256(c, b); c = _mm256_sub_epi32(c, AVX2_ROT(b,14));
+	a = _mm256_xor_si256(a, c); a = _mm256_sub_epi32(a, AVX2_ROT(c,11));
+	b = _mm256_xor_si256(b, a); b = _mm256_sub_epi32(b, AVX2_ROT(a,25));
+	c = _mm256_xor_si256(c, b); c = _mm256_sub_epi32(c, AVX2_ROT(b,16));
+	a = _mm256_xor_si256(a, c); a = _mm256_sub_epi32(a, AVX2_ROT(c, 4));
+	b = _mm256_xor_si256(b, a); b = _mm256_sub_epi32(b, AVX2_ROT(a,14));
+	c = _mm256_xor_si256(c, b); c = _mm256_sub_epi32(c, AVX2_ROT(b,24));
+
+	return c;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+feistel_mix_avx2(__m256i x)
+{
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+	x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x85ebca6b));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 13));
+	x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0xc2b2ae35));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+
+	return x;
+}
+
+__attribute__((target("avx2")))
+static pg_attribute_always_inline void
+feistel_rounds_avx2_impl(const CipherContext *ctx, uint32 *l, uint32 *r,
+			 int count, int direction, int algorithm, int nr)
+{
+	uint32 rk[PERMUTESEQ_MAX_ROUNDS];
+	__m256i vmask = _mm256_set1_epi32(ctx->mask);
+	int i, j;
+
+	get_round_keys(ctx, direction, nr, rk);
+
+	for (j = 0; j + 8 <= count; j += 8)
+	{
+		__m256i l1 = _mm256_loadu_si256((const __m256i *) (l + j));
+		__m256i r1 = _mm256_loadu_si256((const __m256i *) (r + j));
+		__m256i r2;
+
+		for (i = 0; i < nr; i++)
+		{
+			__m256i vrk = _mm256_set1_epi32(rk[i]);
+
+			if (algorithm == PERMUTESEQ_ALGO_MIX)
+				r2 = feistel_mix_avx2(_mm256_xor_si256(r1, vrk));
+			else
+				r2 = _mm256_xor_si256(feistel_hash_avx2(r1), vrk);
+			r2 = _mm256_and_si256(_mm256_xor_si256(l1, r2), vmask);
+			l1 = r1;
+			r1 = r2;
+		}
+		_mm256_storeu_si256((__m256i *) (l + j), l1);
+		_mm256_storeu_si256((__m256i *) (r + j), r1);
+	}
+
+	if (j < count)
+		feistel_rounds_scalar(ctx, l + j, r + j, count - j, direction);
+}
+
+__attribute__((target("avx2")))
+static void
+feistel_rounds_avx2(const CipherContext *ctx, uint32 *l, uint32 *r,
+		    int count, int direction)
+{
+	FEISTEL_DISPATCH(feistel_rounds_avx2_impl, ctx, l, r, count, direction);
+}
+
+#endif							/* USE_AVX2_FEISTEL */
+
+#ifdef USE_AVX512_FEISTEL
+
+__attribute__((target("avx512f")))
+static inline __m512i
+feistel_hash_avx512(__m512i k)
+{
+	__m512i a, b, c;
+
+	a = b = c = _mm512_set1_epi32(FEISTEL_HASH_INIT);
+	a = _mm512_add_epi32(a, k);
+
+	c = _mm512_xor_si512(c, b); c = _mm512_sub_epi32(c, _mm512_rol_epi32(b,14));
+	a = _mm512_xor_si512(a, c); a = _mm512_sub_epi32(a, _mm512_rol_epi32(c,11));
+	b = _mm512_xor_si512(b, a); b = _mm512_sub_epi32(b, _mm512_rol_epi32(a,25));
+	c = _mm512_xor_si512(c, b); c = _mm512_sub_epi32(c, _mm512_rol_epi32(b,16));
+	a = _mm512_xor_si512(a, c); a = _mm512_sub_epi32(a, _mm512_rol_epi32(c, 4));
+	b = _mm512_xor_si512(b, a); b = _mm512_sub_epi32(b, _mm512_rol_epi32(a,14));
+	c = _mm512_xor_si512(c, b); c = _mm512_sub_epi32(c, _mm512_rol_epi32(b,24));
+
+	return c;
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i
+feistel_mix_avx512(__m512i x)
+{
+	x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 16));
+	x = _mm512_mullo_epi32(x, _mm512_set1_epi32(0x85ebca6b));
+	x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 13));
+	x = _mm512_mullo_epi32(x, _mm512_set1_epi32(0xc2b2ae35));
+	x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 16));
+
+	return x;
+}
+
+__attribute__((target("avx512f")))
+static pg_attribute_always_inline void
+feistel_rounds_avx512_impl(const CipherContext *ctx, uint32 *l, uint32 *r,
+			   int count, int direction, int algorithm, int nr)
+{
+	uint32 rk[PERMUTESEQ_MAX_ROUNDS];
+	__m512i vmask = _mm512_set1_epi32(ctx->mask);
+	int i, j;
+
+	get_round_keys(ctx, direction, nr, rk);
+
+	for (j = 0; j + 16 <= count; j += 16)
+	{
+		__m512i l1 = _mm512_loadu_si512((const void *) (l + j));
+		__m512i r1 = _mm512_loadu_si512((const void *) (r + j));
+		__m512i r2;
+
+		for (i = 0; i < nr; i++)
+		{
+			__m512i vrk = _mm512_set1_epi32(rk[i]);
+
+			if (algorithm == PERMUTESEQ_ALGO_MIX)
+				r2 = feistel_mix_avx512(_mm512_xor_si512(r1, vrk));
+			else
+				r2 = _mm512_xor_si512(feistel_hash_avx512(r1), vrk);
+			r2 = _mm512_and_si512(_mm512_xor_si512(l1, r2), vmask);
+			l1 = r1;
+			r1 = r2;
+		}
+		_mm512_storeu_si512((void *) (l + j), l1);
+		_mm512_storeu_si512((void *) (r + j), r1);
+	}
+
+	if (j < count)
+		feistel_rounds_scalar(ctx, l + j, r + j, count - j, direction);
+}
+
+__attribute__((target("avx512f")))
+static void
+feistel_rounds_avx512(const CipherContext *ctx, uint32 *l, uint32 *r,
+		      int count, int direction)
+{
+	FEISTEL_DISPATCH(feistel_rounds_avx512_impl, ctx, l, r, count, direction);
+}
+
+#endif							/* USE_AVX512_FEISTEL */
+
+#ifdef USE_NEON_FEISTEL
+
+#define NEON_ROT(x,k) vorrq_u32(vshlq_n_u32((x), (k)), vshrq_n_u32((x), 32-(k)))
+
+static inline uint32x4_t
+feistel_hash_neon(uint32x4_t k)
+{
+	uint32x4_t a, b, c;
+
+	a = b = c = vdupq_n_u32(FEISTEL_HASH_INIT);
+	a = vaddq_u32(a, k);
+
+	c = veorq_u32(c, b); c = vsubq_u32(c, NEON_ROT(b,14));
+	a = veorq_u32(a, c); a = vsubq_u32(a, NEON_ROT(c,11));
+	b = veorq_u32(b, a); b = vsubq_u32(b, NEON_ROT(a,25));
+	c = veorq_u32(c, b); c = vsubq_u32(c, NEON_ROT(b,16));
+	a = veorq_u32(a, c); a = vsubq_u32(a, NEON_ROT(c, 4));
+	b = veorq_u32(b, a); b = vsubq_u32(b, NEON_ROT(a,14));
+	c = veorq_u32(c, b); c = vsubq_u32(c, NEON_ROT(b,24));
+
+	return c;
+}
+
+static inline uint32x4_t
+feistel_mix_neon(uint32x4_t x)
+{
+	x = veorq_u32(x, vshrq_n_u32(x, 16));
+	x = vmulq_u32(x, vdupq_n_u32(0x85ebca6b));
+	x = veorq_u32(x, vshrq_n_u32(x, 13));
+	x = vmulq_u32(x, vdupq_n_u32(0xc2b2ae35));
+	x = veorq_u32(x, vshrq_n_u32(x, 16));
+
+	return x;
+}
+
+static pg_attribute_always_inline void
+feistel_rounds_neon_impl(const CipherContext *ctx, uint32 *l, uint32 *r,
+			 int count, int direction, int algorithm, int nr)
+{
+	uint32 rk[PERMUTESEQ_MAX_ROUNDS];
+	uint32x4_t vmask = vdupq_n_u32(ctx->mask);
+	int i, j;
+
+	get_round_keys(ctx, direction, nr, rk);
+
+	for (j = 0; j + 4 <= count; j += 4)
+	{
+		uint32x4_t l1 = vld1q_u32(l + j);
+		uint32x4_t r1 = vld1q_u32(r + j);
+		uint32x4_t r2;
+
+		for (i = 0; i < nr; i++)
+		{
+			uint32x4_t vrk = vdupq_n_u32(rk[i]);
+
+			if (algorithm == PERMUTESEQ_ALGO_MIX)
+				r2 = feistel_mix_neon(veorq_u32(r1, vrk));
+			else
+				r2 = veorq_u32(feistel_hash_neon(r1), vrk);
+			r2 = vandq_u32(veorq_u32(l1, r2), vmask);
+			l1 = r1;
+			r1 = r2;
+		}
+		vst1q_u32(l + j, l1);
+		vst1q_u32(r + j, r1);
+	}
+
+	if (j < count)
+		feistel_rounds_scalar(ctx, l + j, r + j, count - j, direction);
+}
+
+static void
+feistel_rounds_neon(const CipherContext *ctx, uint32 *l, uint32 *r,
+		    int count, int direction)
+{
+	FEISTEL_DISPATCH(feistel_rounds_neon_impl, ctx, l, r, count, direction);
+}
+
+#endif							/* USE_NEON_FEISTEL */
+
+/*
+ * Choose the best implementation of feistel_rounds for the CPU we're
+ * running on. Returns its name.
+ */
+const char *
+select_feistel_rounds(void)
+{
+#if defined(USE_AVX2_FEISTEL) || defined(USE_AVX512_FEISTEL)
+	__builtin_cpu_init();
+#endif
+
+#ifdef USE_AVX512_FEISTEL
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		feistel_rounds = feistel_rounds_avx512;
+		return "avx512";
+	}
+#endif
+#ifdef USE_AVX2_FEISTEL
+	if (__builtin_cpu_supports("avx2"))
+	{
+		feistel_rounds = feistel_rounds_avx2;
+		return "avx2";
+	}
+#endif
+#ifdef USE_NEON_FEISTEL
+	feistel_rounds = feistel_rounds_neon;
+	return "neon";
+#else
+	feistel_rounds = feistel_rounds_scalar;
+	return "scalar";
+#endif
+}
@@ -0,0 +1,629 @@
+ALTER FUNCTION range_encrypt_element(int8,int8,int8,int8) PARALLEL SAFE;
+ALTER FUNCTION range_decrypt_element(int8,int8,int8,int8) PARALLEL SAFE;
+
+CREATE FUNCTION permute_nextval_batch(seq_oid oid, crypt_key int8, count int8)
+RETURNS SETOF int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION permute_nextval_batch(oid,int8,int8)
+IS 'Advance sequence count times and return the new values encrypted within the bounds of the sequence';
+
+CREATE FUNCTION permute_nextval_array(seq_oid oid, crypt_key int8, count int8)
+RETURNS int8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION permute_nextval_array(oid,int8,int8)
+IS 'Advance sequence count times and return an array of the new values encrypted within the bounds of the sequence';
+
+CREATE FUNCTION range_encrypt_array(
+  clear_vals int8[], min_val int8, max_val int8, crypt_key int8)
+RETURNS int8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_encrypt_array(int8[],int8,int8,int8)
+IS 'Encrypt an array of bigint elements within the (min,max) range and an int8 key';
+
+CREATE FUNCTION range_decrypt_array(
+  crypt_vals int8[], min_val int8, max_val int8, crypt_key int8)
+RETURNS int8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_decrypt_array(int8[],int8,int8,int8)
+IS 'Decrypt an array of bigint elements encrypted with range_encrypt_element or range_encrypt_array';
+
+CREATE FUNCTION range_encrypt_element(
+  clear_val int8, min_val int8, max_val int8, crypt_key int8,
+  algorithm int4, rounds int4 DEFAULT 9)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_encrypt_element(int8,int8,int8,int8,int4,int4)
+IS 'Encrypt a bigint element within the (min,max) range and an int8 key, with the given algorithm and number of rounds';
+
+CREATE FUNCTION range_decrypt_element(
+  crypt_val int8, min_val int8, max_val int8, crypt_key int8,
+  algorithm int4, rounds int4 DEFAULT 9)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_decrypt_element(int8,int8,int8,int8,int4,int4)
+IS 'Decrypt a bigint element encrypted with range_encrypt_element, with the given algorithm and number of rounds';
+
+CREATE FUNCTION range_encrypt_array(
+  clear_vals int8[], min_val int8, max_val int8, crypt_key int8,
+  algorithm int4, rounds int4 DEFAULT 9)
+RETURNS int8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_encrypt_array(int8[],int8,int8,int8,int4,int4)
+IS 'Encrypt an array of bigint elements within the (min,max) range and an int8 key, with the given algorithm and number of rounds';
+
+CREATE FUNCTION range_decrypt_array(
+  crypt_vals int8[], min_val int8, max_val int8, crypt_key int8,
+  algorithm int4, rounds int4 DEFAULT 9)
+RETURNS int8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_decrypt_array(int8[],int8,int8,int8,int4,int4)
+IS 'Decrypt an array of bigint elements encrypted with range_encrypt_element or range_encrypt_array, with the given algorithm and number of rounds';
+
+-- Options of the permutations of sequences, used by permute_nextval
+-- and reverse_permute. Sequences without an entry use the defaults.
+-- crypt_key is set by permuteseq_register for permuteseq_nextval and
+-- permuteseq_reverse. The table must not be readable by the users of
+-- the sequences.
+CREATE TABLE permuteseq_sequences (
+  seq regclass PRIMARY KEY,
+  algorithm int4 NOT NULL DEFAULT 1,
+  rounds int4 NOT NULL DEFAULT 9,
+  crypt_key int8
+);
+
+REVOKE ALL ON permuteseq_sequences FROM PUBLIC;
+
+SELECT pg_catalog.pg_extension_config_dump('permuteseq_sequences', '');
+
+CREATE FUNCTION permuteseq_sequences_trigger()
+RETURNS trigger
+AS 'MODULE_PATHNAME'
+LANGUAGE C;
+
+CREATE TRIGGER permuteseq_sequences_changed
+AFTER INSERT OR UPDATE OR DELETE OR TRUNCATE ON permuteseq_sequences
+FOR EACH STATEMENT EXECUTE PROCEDURE permuteseq_sequences_trigger();
+
+CREATE FUNCTION permuteseq_set_options(seq regclass,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION permuteseq_set_options(regclass,int4,int4)
+IS 'Set the algorithm and number of rounds used to permute the values of a sequence';
+
+CREATE FUNCTION range_expected_walks(
+  min_val int8, max_val int8, algorithm int4 DEFAULT 1)
+RETURNS float8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_expected_walks(int8,int8,int4)
+IS 'Average number of passes through the Feistel network to encrypt or decrypt a value of the (min,max) range with the given algorithm';
+
+CREATE FUNCTION range_permutation(min_val int8, max_val int8, crypt_key int8)
+RETURNS SETOF int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_permutation(int8,int8,int8)
+IS 'Return all the elements of the (min,max) range encrypted with an int8 key, in the order of the clear values, with the default algorithm and rounds';
+
+CREATE FUNCTION range_permutation_chunk(
+  min_val int8, max_val int8, crypt_key int8, chunk_no int4, chunk_count int4,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS SETOF int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_permutation_chunk(int8,int8,int8,int4,int4,int4,int4)
+IS 'Return the part chunk_no (from 0) of chunk_count parts of the permutation of the (min,max) range, with the given algorithm and number of rounds';
+
+CREATE FUNCTION range_permutation(
+  min_val int8, max_val int8, crypt_key int8, "offset" int8, count int8,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS SETOF int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_permutation(int8,int8,int8,int8,int8,int4,int4)
+IS 'Return count elements of the permutation of the (min,max) range, starting at offset (from 0), with the given algorithm and number of rounds';
+
+CREATE FUNCTION permuteseq_register(seq regclass, crypt_key int8,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION permuteseq_register(regclass,int8,int4,int4)
+IS 'Register a sequence with a key and options for permuteseq_nextval and permuteseq_reverse';
+
+CREATE FUNCTION permuteseq_nextval(seq regclass)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION permuteseq_nextval(regclass)
+IS 'Advance a registered sequence and return the new value encrypted with its key';
+
+CREATE FUNCTION permuteseq_reverse(seq regclass, value int8)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION permuteseq_reverse(regclass,int8)
+IS 'Compute and return the original clear value from its permuted element in a registered sequence';
+
+-- Types created by permuteseq_create_type, with their registered sequence
+CREATE TABLE permuteseq_types (
+  typ regtype PRIMARY KEY,
+  seq regclass NOT NULL
+);
+
+SELECT pg_catalog.pg_extension_config_dump('permuteseq_types', '');
+
+CREATE FUNCTION permuteseq_create_type(type_name text, seq regclass)
+RETURNS regtype
+LANGUAGE plpgsql VOLATILE STRICT
+AS $$
+DECLARE
+  ext_schema name;
+  typ regtype;
+  byval bool;
+BEGIN
+  -- The I/O functions are in C and the casts without functions, which
+  -- only superusers can create
+  IF pg_catalog.current_setting('is_superuser') <> 'on' THEN
+    RAISE EXCEPTION 'must be superuser to create a type with permuteseq_create_type()';
+  END IF;
+
+  SELECT n.nspname INTO ext_schema
+    FROM pg_catalog.pg_extension e
+    JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace
+    WHERE e.extname = 'permuteseq';
+
+  EXECUTE format('SELECT 1 FROM %I.permuteseq_sequences'
+                 ' WHERE seq = $1 AND crypt_key IS NOT NULL', ext_schema)
+    USING seq;
+  IF NOT FOUND THEN
+    RAISE EXCEPTION 'sequence % is not registered', seq
+      USING HINT = 'Register it with a key with permuteseq_register().';
+  END IF;
+
+  EXECUTE format('CREATE TYPE %I', type_name);
+
+  -- The shell type just created, in the creation schema, rather than
+  -- the name looked up through the search_path
+  SELECT t.oid INTO typ
+    FROM pg_catalog.pg_type t
+    JOIN pg_catalog.pg_namespace n ON n.oid = t.typnamespace
+    WHERE t.typname = type_name AND n.nspname = pg_catalog.current_schema();
+
+  EXECUTE format('CREATE FUNCTION %I(cstring, oid, int4) RETURNS %s'
+                 ' AS %L, %L LANGUAGE C STABLE STRICT',
+                 type_name || '_in', typ,
+                 'MODULE_PATHNAME', 'permuteseq_type_in');
+  EXECUTE format('CREATE FUNCTION %I(%s) RETURNS cstring'
+                 ' AS %L, %L LANGUAGE C STABLE STRICT',
+                 type_name || '_out', typ,
+                 'MODULE_PATHNAME', 'permuteseq_type_out');
+  EXECUTE format('CREATE FUNCTION %I(internal, oid, int4) RETURNS %s'
+                 ' AS %L, %L LANGUAGE C STABLE STRICT',
+                 type_name || '_recv', typ,
+                 'MODULE_PATHNAME', 'permuteseq_type_recv');
+  EXECUTE format('CREATE FUNCTION %I(%s) RETURNS bytea'
+                 ' AS %L, %L LANGUAGE C STABLE STRICT',
+                 type_name || '_send', typ,
+                 'MODULE_PATHNAME', 'permuteseq_type_send');
+
+  -- Same storage as int8, holding the clear position, passed by value
+  -- only when int8 is (not on 32-bit builds)
+  SELECT t.typbyval INTO byval
+    FROM pg_catalog.pg_type t
+    WHERE t.oid = 'pg_catalog.int8'::pg_catalog.regtype;
+
+  EXECUTE format('CREATE TYPE %s (INPUT = %I, OUTPUT = %I,'
+                 ' RECEIVE = %I, SEND = %I, INTERNALLENGTH = 8,%s'
+                 ' ALIGNMENT = double, STORAGE = plain)',
+                 typ, type_name || '_in', type_name || '_out',
+                 type_name || '_recv', type_name || '_send',
+                 CASE WHEN byval THEN ' PASSEDBYVALUE,' ELSE '' END);
+
+  -- Casts from and to the clear position
+  EXECUTE format('CREATE CAST (int8 AS %s) WITHOUT FUNCTION', typ);
+  EXECUTE format('CREATE CAST (%s AS int8) WITHOUT FUNCTION', typ);
+
+  -- Comparisons of the clear positions, with the int8 functions
+  EXECUTE format('CREATE FUNCTION %I(%s, %s) RETURNS bool AS %L'
+                 ' LANGUAGE internal IMMUTABLE STRICT PARALLEL SAFE',
+                 type_name || '_eq', typ, typ, 'int8eq');
+  EXECUTE format('CREATE FUNCTION %I(%s, %s) RETURNS bool AS %L'
+                 ' LANGUAGE internal IMMUTABLE STRICT PARALLEL SAFE',
+                 type_name || '_ne', typ, typ, 'int8ne');
+  EXECUTE format('CREATE FUNCTION %I(%s, %s) RETURNS bool AS %L'
+                 ' LANGUAGE internal IMMUTABLE STRICT PARALLEL SAFE',
+                 type_name || '_lt', typ, typ, 'int8lt');
+  EXECUTE format('CREATE FUNCTION %I(%s, %s) RETURNS bool AS %L'
+                 ' LANGUAGE internal IMMUTABLE STRICT PARALLEL SAFE',
+                 type_name || '_le', typ, typ, 'int8le');
+  EXECUTE format('CREATE FUNCTION %I(%s, %s) RETURNS bool AS %L'
+                 ' LANGUAGE internal IMMUTABLE STRICT PARALLEL SAFE',
+                 type_name || '_gt', typ, typ, 'int8gt');
+  EXECUTE format('CREATE FUNCTION %I(%s, %s) RETURNS bool AS %L'
+                 ' LANGUAGE internal IMMUTABLE STRICT PARALLEL SAFE',
+                 type_name || '_ge', typ, typ, 'int8ge');
+  EXECUTE format('CREATE FUNCTION %I(%s, %s) RETURNS int4 AS %L'
+                 ' LANGUAGE internal IMMUTABLE STRICT PARALLEL SAFE',
+                 type_name || '_cmp', typ, typ, 'btint8cmp');
+  EXECUTE format('CREATE FUNCTION %I(%s) RETURNS int4 AS %L'
+                 ' LANGUAGE internal IMMUTABLE STRICT PARALLEL SAFE',
+                 type_name || '_hash', typ, 'hashint8');
+
+  EXECUTE format('CREATE OPERATOR = (LEFTARG = %s, RIGHTARG = %s,'
+                 ' FUNCTION = %I, COMMUTATOR = =, NEGATOR = <>,'
+                 ' RESTRICT = eqsel, JOIN = eqjoinsel, HASHES, MERGES)',
+                 typ, typ, type_name || '_eq');
+  EXECUTE format('CREATE OPERATOR <> (LEFTARG = %s, RIGHTARG = %s,'
+                 ' FUNCTION = %I, COMMUTATOR = <>, NEGATOR = =,'
+                 ' RESTRICT = neqsel, JOIN = neqjoinsel)',
+                 typ, typ, type_name || '_ne');
+  EXECUTE format('CREATE OPERATOR < (LEFTARG = %s, RIGHTARG = %s,'
+                 ' FUNCTION = %I, COMMUTATOR = >, NEGATOR = >=,'
+                 ' RESTRICT = scalarltsel, JOIN = scalarltjoinsel)',
+                 typ, typ, type_name || '_lt');
+  EXECUTE format('CREATE OPERATOR <= (LEFTARG = %s, RIGHTARG = %s,'
+                 ' FUNCTION = %I, COMMUTATOR = >=, NEGATOR = >,'
+                 ' RESTRICT = scalarltsel, JOIN = scalarltjoinsel)',
+                 typ, typ, type_name || '_le');
+  EXECUTE format('CREATE OPERATOR > (LEFTARG = %s, RIGHTARG = %s,'
+                 ' FUNCTION = %I, COMMUTATOR = <, NEGATOR = <=,'
+                 ' RESTRICT = scalargtsel, JOIN = scalargtjoinsel)',
+                 typ, typ, type_name || '_gt');
+  EXECUTE format('CREATE OPERATOR >= (LEFTARG = %s, RIGHTARG = %s,'
+                 ' FUNCTION = %I, COMMUTATOR = <=, NEGATOR = <,'
+                 ' RESTRICT = scalargtsel, JOIN = scalargtjoinsel)',
+                 typ, typ, type_name || '_ge');
+
+  EXECUTE format('CREATE OPERATOR CLASS %I DEFAULT FOR TYPE %s USING btree AS'
+                 ' OPERATOR 1 <, OPERATOR 2 <=, OPERATOR 3 =,'
+                 ' OPERATOR 4 >=, OPERATOR 5 >, FUNCTION 1 %I(%s, %s)',
+                 type_name || '_ops', typ, type_name || '_cmp', typ, typ);
+  EXECUTE format('CREATE OPERATOR CLASS %I DEFAULT FOR TYPE %s USING hash AS'
+                 ' OPERATOR 1 =, FUNCTION 1 %I(%s)',
+                 type_name || '_ops', typ, type_name || '_hash', typ);
+
+  EXECUTE format('INSERT INTO %I.permuteseq_types(typ, seq) VALUES ($1, $2)',
+                 ext_schema)
+    USING typ, seq;
+
+  RETURN typ;
+END
+$$;
+
+COMMENT ON FUNCTION permuteseq_create_type(text,regclass)
+IS 'Create a type storing clear positions of a registered sequence, encrypted on output and decrypted on input';
+
+-- Forget the types created by permuteseq_create_type when they are
+-- dropped, directly or with their schema or owner. It runs as the owner
+-- of the extension, since the roles dropping types can't write in
+-- permuteseq_types.
+CREATE FUNCTION permuteseq_types_drop()
+RETURNS event_trigger
+LANGUAGE plpgsql SECURITY DEFINER
+SET search_path = pg_catalog
+AS $$
+DECLARE
+  ext_schema name;
+BEGIN
+  SELECT n.nspname INTO ext_schema
+    FROM pg_catalog.pg_extension e
+    JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace
+    WHERE e.extname = 'permuteseq';
+
+  IF ext_schema IS NOT NULL THEN
+    EXECUTE format('DELETE FROM %I.permuteseq_types t'
+                   ' USING pg_catalog.pg_event_trigger_dropped_objects() d'
+                   ' WHERE d.classid = ''pg_catalog.pg_type''::pg_catalog.regclass'
+                   ' AND d.objid = t.typ::pg_catalog.oid', ext_schema);
+  END IF;
+END
+$$;
+
+CREATE EVENT TRIGGER permuteseq_types_drop ON sql_drop
+  EXECUTE PROCEDURE permuteseq_types_drop();
+
+CREATE FUNCTION permute_position(seq_oid oid, clear_val int8, crypt_key int8)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+COMMENT ON FUNCTION permute_position(oid,int8,int8)
+IS 'Encrypt a position of the sequence as permute_nextval would, without advancing the sequence';
+
+CREATE FUNCTION permuteseq_support(internal)
+RETURNS internal
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT;
+
+CREATE FUNCTION reverse_permutes_to(
+  seq_oid oid, value int8, crypt_key int8, clear_val int8)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+COMMENT ON FUNCTION reverse_permutes_to(oid,int8,int8,int8)
+IS 'Test whether reverse_permute(seq_oid, value, crypt_key) = clear_val, using an index on value';
+
+CREATE FUNCTION range_decrypts_to(
+  crypt_val int8, min_val int8, max_val int8, crypt_key int8, clear_val int8,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS bool
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_decrypts_to(int8,int8,int8,int8,int8,int4,int4)
+IS 'Test whether range_decrypt_element(crypt_val, ...) = clear_val, using an index on crypt_val';
+
+-- Planner support functions appeared in PostgreSQL 12
+DO $$
+BEGIN
+  IF current_setting('server_version_num')::int >= 120000 THEN
+    EXECUTE 'ALTER FUNCTION reverse_permutes_to(oid,int8,int8,int8)'
+      ' SUPPORT permuteseq_support';
+    EXECUTE 'ALTER FUNCTION range_decrypts_to(int8,int8,int8,int8,int8,int4,int4)'
+      ' SUPPORT permuteseq_support';
+  END IF;
+END
+$$;
+
+CREATE FUNCTION permuteseq_stats(
+  OUT calls int8, OUT walks int8, OUT max_walks int8,
+  OUT table_lookups int8, OUT table_builds int8,
+  OUT context_hits int8, OUT context_misses int8,
+  OUT bounds_hits int8, OUT bounds_misses int8,
+  OUT shared_hits int8, OUT shared_misses int8,
+  OUT stats_reset timestamptz)
+RETURNS record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE PARALLEL RESTRICTED;
+
+COMMENT ON FUNCTION permuteseq_stats()
+IS 'Counters of values permuted, Feistel passes and cache hits, for all sessions when preloaded';
+
+CREATE VIEW permuteseq_stats AS
+  SELECT * FROM permuteseq_stats();
+
+CREATE FUNCTION permuteseq_stats_reset()
+RETURNS void
+AS 'MODULE_PATHNAME'
+LANGUAGE C STRICT VOLATILE;
+
+COMMENT ON FUNCTION permuteseq_stats_reset()
+IS 'Reset the counters of permuteseq_stats';
+
+REVOKE ALL ON FUNCTION permuteseq_stats_reset() FROM PUBLIC;
+
+CREATE FUNCTION reverse_permute_array(seq_oid oid, vals int8[], crypt_key int8)
+RETURNS int8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+COMMENT ON FUNCTION reverse_permute_array(oid,int8[],int8)
+IS 'Apply reverse_permute() to all the elements of an array';
+
+CREATE FUNCTION reverse_permute_rows(seq_oid oid, vals int8[], crypt_key int8,
+  OUT value int8, OUT clear_val int8)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+COMMENT ON FUNCTION reverse_permute_rows(oid,int8[],int8)
+IS 'Return the pairs (value, reverse_permute(seq_oid, value, crypt_key)) of the elements of an array, in order';
+
+CREATE FUNCTION range_encrypt_versioned(
+  clear_val int8, min_val int8, max_val int8, crypt_keys int8[], key_version int4,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_encrypt_versioned(int8,int8,int8,int8[],int4,int4,int4)
+IS 'Encrypt a value with the key of a version, the version being recoverable from the result';
+
+CREATE FUNCTION range_decrypt_versioned(
+  crypt_val int8, min_val int8, max_val int8, crypt_keys int8[],
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_decrypt_versioned(int8,int8,int8,int8[],int4,int4)
+IS 'Decrypt a value encrypted by range_encrypt_versioned() with the key of its version';
+
+CREATE FUNCTION range_key_version(crypt_val int8, min_val int8, max_val int8, key_count int4)
+RETURNS int4
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_key_version(int8,int8,int8,int4)
+IS 'Return the key version of a value encrypted by range_encrypt_versioned()';
+
+CREATE FUNCTION permute_nextval_versioned(seq_oid oid, crypt_keys int8[], key_version int4)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C VOLATILE STRICT;
+
+COMMENT ON FUNCTION permute_nextval_versioned(oid,int8[],int4)
+IS 'Return the next value of the sequence, permuted with the key of a version';
+
+CREATE FUNCTION reverse_permute_versioned(seq_oid oid, value int8, crypt_keys int8[])
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C STABLE STRICT;
+
+COMMENT ON FUNCTION reverse_permute_versioned(oid,int8,int8[])
+IS 'Return the clear value of a value produced by permute_nextval_versioned()';
+
+CREATE FUNCTION permuteseq_copy(target regclass, id_column name, source text,
+                                format text DEFAULT 'text', delimiter text DEFAULT '',
+                                header bool DEFAULT false)
+RETURNS int8
+LANGUAGE plpgsql VOLATILE STRICT
+AS $$
+DECLARE
+  id_default text;
+  col_list text;
+  copy_options text;
+  prev_block_size text;
+  max_block_size int8;
+  nblocks int8;
+  nrows int8;
+BEGIN
+  SELECT pg_catalog.pg_get_expr(d.adbin, d.adrelid) INTO id_default
+    FROM pg_catalog.pg_attribute a
+    LEFT JOIN pg_catalog.pg_attrdef d
+      ON d.adrelid = a.attrelid AND d.adnum = a.attnum
+    WHERE a.attrelid = target AND a.attname = id_column
+      AND a.attnum > 0 AND NOT a.attisdropped;
+  IF NOT FOUND THEN
+    RAISE EXCEPTION 'column % of % does not exist', id_column, target;
+  END IF;
+  IF id_default IS NULL OR
+     (position('permuteseq_nextval(' IN id_default) = 0 AND
+      position('permute_nextval(' IN id_default) = 0) THEN
+    RAISE EXCEPTION 'the default of column % of % is not a permuted sequence',
+      id_column, target
+      USING HINT = 'Set its default to permuteseq_nextval() or permute_nextval().';
+  END IF;
+  IF lower(format) NOT IN ('text', 'csv', 'binary') THEN
+    RAISE EXCEPTION 'invalid COPY format: %', format
+      USING HINT = 'The format must be text, csv or binary.';
+  END IF;
+
+  -- The options are passed to COPY as literals, never as SQL text
+  copy_options := pg_catalog.format('FORMAT %s', lower(format));
+  IF delimiter <> '' THEN
+    copy_options := copy_options || pg_catalog.format(', DELIMITER %L', delimiter);
+  END IF;
+  IF header THEN
+    copy_options := copy_options || ', HEADER';
+  END IF;
+
+  -- The other columns, in the order of the table, which is the
+  -- order of the data, except the generated columns that COPY FROM
+  -- refuses (attgenerated is read through to_jsonb() since it
+  -- only exists with PostgreSQL 12 or newer)
+  SELECT pg_catalog.string_agg(pg_catalog.quote_ident(a.attname), ', '
+                               ORDER BY a.attnum) INTO col_list
+    FROM pg_catalog.pg_attribute a
+    WHERE a.attrelid = target AND a.attname <> id_column
+      AND a.attnum > 0 AND NOT a.attisdropped
+      AND coalesce(pg_catalog.to_jsonb(a) ->> 'attgenerated', '') = '';
+
+  -- Load the rows into a temporary table, which isn't WAL-logged, to
+  -- know how many IDs to claim
+  EXECUTE pg_catalog.format('CREATE TEMPORARY TABLE permuteseq_copy_rows'
+                            ' ON COMMIT DROP AS SELECT %s FROM %s WITH NO DATA',
+                            col_list, target);
+  EXECUTE pg_catalog.format('COPY pg_temp.permuteseq_copy_rows FROM %L WITH (%s)',
+                            source, copy_options);
+  GET DIAGNOSTICS nrows = ROW_COUNT;
+
+  IF nrows > 0 THEN
+    -- Claim the positions for all the rows as one block, or as blocks
+    -- of equal sizes within the maximum of prealloc_block_size, to
+    -- leave fewer than one unused position per block. The setting is
+    -- missing from pg_settings until the library is loaded.
+    SELECT s.max_val::int8 INTO max_block_size
+      FROM pg_catalog.pg_settings s
+      WHERE s.name = 'permuteseq.prealloc_block_size';
+    max_block_size := coalesce(max_block_size, 1000000);
+    nblocks := (nrows + max_block_size - 1) / max_block_size;
+
+    prev_block_size := coalesce(pg_catalog.current_setting('permuteseq.prealloc_block_size', true), '0');
+    PERFORM pg_catalog.set_config('permuteseq.prealloc_block_size',
+                                  ((nrows + nblocks - 1) / nblocks)::text, true);
+
+    EXECUTE pg_catalog.format('INSERT INTO %s (%s) SELECT %s FROM pg_temp.permuteseq_copy_rows',
+                              target, col_list, col_list);
+
+    PERFORM pg_catalog.set_config('permuteseq.prealloc_block_size',
+                                  prev_block_size, true);
+  END IF;
+
+  DROP TABLE pg_temp.permuteseq_copy_rows;
+
+  RETURN nrows;
+END
+$$;
+
+COMMENT ON FUNCTION permuteseq_copy(regclass,name,text,text,text,bool)
+IS 'Copy a file of the server into a table whose ID column defaults to a permuted sequence, claiming and encrypting the IDs as one block';
+
+CREATE FUNCTION range_sample(
+  min_val int8, max_val int8, crypt_key int8, k int8,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS int8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_sample(int8,int8,int8,int8,int4,int4)
+IS 'Return the first k elements of the permutation of the (min,max) range, as a sample without replacement';
+
+CREATE FUNCTION range_sample_filtered(
+  min_val int8, max_val int8, crypt_key int8, k int8,
+  filter_min int8, filter_max int8,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS int8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_sample_filtered(int8,int8,int8,int8,int8,int8,int4,int4)
+IS 'Return the first k elements of the permutation of the (min,max) range that are within (filter_min,filter_max)';
+
+CREATE FUNCTION range_permutation_window(
+  min_val int8, max_val int8, crypt_key int8, start_rank int8, n int8,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS int8[]
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_permutation_window(int8,int8,int8,int8,int8,int4,int4)
+IS 'Return n elements of the permutation of the (min,max) range from start_rank (from 0), as an array';
+
+CREATE FUNCTION range_value_at(
+  rank int8, min_val int8, max_val int8, crypt_key int8,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_value_at(int8,int8,int8,int8,int4,int4)
+IS 'Return the element at a rank (from 0) of the permutation of the (min,max) range';
+
+CREATE FUNCTION range_position_of(
+  crypt_val int8, min_val int8, max_val int8, crypt_key int8,
+  algorithm int4 DEFAULT 1, rounds int4 DEFAULT 9)
+RETURNS int8
+AS 'MODULE_PATHNAME'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+COMMENT ON FUNCTION range_position_of(int8,int8,int8,int8,int4,int4)
+IS 'Return the rank (from 0) of an element in the permutation of the (min,max) range';
@@ -0,0 +1,63 @@
+-- Functions over ranges: arrays, sets, samples, ranks and versioned keys
+CREATE EXTENSION permuteseq;
+-- arrays keep their NULLs and dimensions
+SELECT range_encrypt_array(ARRAY[1, NULL, 2, NULL, 3, -1000], -1000, 1000, 42) AS encrypted;
+SELECT range_encrypt_array(ARRAY[[1, 2], [3, 4]], -1000, 1000, 42, 4) AS encrypted;
+SELECT range_encrypt_array('{}'::bigint[], -1000, 1000, 42) AS encrypted;
+SELECT range_decrypt_array(range_encrypt_array(ARRAY[NULL, 5, NULL], -1000, 1000, 42, 5), -1000, 1000, 42, 5) AS decrypted;
+-- range_decrypts_to()
+SELECT range_decrypts_to(-50, -1000, 1000, 42, 7, 3) AS yes,
+       range_decrypts_to(-50, -1000, 1000, 42, 8, 3) AS no;
+-- sets of permuted values
+SELECT range_permutation(-50, 50, 7, 95, 10) AS value;
+SELECT (SELECT string_agg(x::text, ',' ORDER BY c, n)
+          FROM generate_series(0, 3) AS c,
+               LATERAL range_permutation_chunk(-50, 50, 7, c, 4) WITH ORDINALITY AS p(x, n)) =
+       (SELECT string_agg(x::text, ',' ORDER BY n)
+          FROM range_permutation(-50, 50, 7) WITH ORDINALITY AS p(x, n)) AS same;
+SELECT md5(string_agg(x::text, ',' ORDER BY n)) AS hash
+  FROM range_permutation(-50, 50, 7) WITH ORDINALITY AS p(x, n);
+SELECT md5(string_agg(x::text, ',' ORDER BY n)) AS hash
+  FROM range_permutation(-50, 50, 7, 0, 101, 3, 12) WITH ORDINALITY AS p(x, n);
+SELECT (SELECT string_agg(x::text, ',' ORDER BY c, n)
+          FROM generate_series(0, 2) AS c,
+               LATERAL range_permutation_chunk(-50, 50, 7, c, 3, 5) WITH ORDINALITY AS p(x, n)) =
+       (SELECT string_agg(x::text, ',' ORDER BY n)
+          FROM range_permutation(-50, 50, 7, 0, 1000, 5) WITH ORDINALITY AS p(x, n)) AS same;
+SELECT range_permutation(-50, 50, 7, 10, 3, 4) AS value;
+-- samples and windows
+SELECT range_sample(1, 1000000000000, 123456789, 5) AS sample;
+SELECT range_sample(1, 4, 123456789, 10) AS sample;
+SELECT range_sample(1, 1000, 123456789, 0) AS sample;
+SELECT range_sample_filtered(1, 100000, 123456789, 5, 1, 1000) AS sample;
+SELECT range_sample_filtered(1, 100000, 123456789, 5, 99998, 200000, 5) AS sample;
+SELECT range_permutation_window(-1000, 1000, 42, 1995, 10) AS page;
+SELECT range_permutation_window(-1000, 1000, 42, 40, 5, 3) AS page;
+-- ranks
+SELECT range_value_at(1234, -1000, 1000, 42, 2) AS value,
+       range_position_of(range_value_at(1234, -1000, 1000, 42, 2), -1000, 1000, 42, 2) AS rank;
+SELECT count(*) AS mismatches FROM generate_series(0, 2000) AS r
+  WHERE range_position_of(range_value_at(r, -1000, 1000, 42), -1000, 1000, 42) <> r;
+-- versioned keys
+SELECT range_key_version(e, -1000, 1000, 3) AS key_version,
+       range_decrypt_versioned(e, -1000, 1000, ARRAY[11, 22, 33], 4) AS decrypted
+  FROM (SELECT range_encrypt_versioned(-500, -1000, 1000, ARRAY[11, 22, 33], ver, 4) AS e
+          FROM generate_series(0, 2) AS ver) AS s;
+-- a single key permutes the whole range, even the full bigint range
+SELECT v AS value,
+       range_encrypt_versioned(v, '-9223372036854775808'::bigint, 9223372036854775807, ARRAY[11], 0) AS versioned,
+       range_encrypt_element(v, '-9223372036854775808'::bigint, 9223372036854775807, 11) AS single
+  FROM unnest(ARRAY['-9223372036854775808'::bigint, -1234567890123, 0, 9223372036854775807]) AS v;
+SELECT range_decrypt_versioned(913335966510511369, '-9223372036854775808'::bigint, 9223372036854775807, ARRAY[11]) AS decrypted;
+-- expected number of passes per value
+SELECT a AS algorithm, round(range_expected_walks(1, 1000, a)::numeric, 4) AS walks
+  FROM generate_series(1, 5) AS a;
+-- errors
+SELECT range_encrypt_element(1001, -1000, 1000, 42);
+SELECT range_encrypt_element(1, -1000, 1000, 42, 6);
+SELECT range_encrypt_element(1, -1000, 1000, 42, 1, 2);
+SELECT range_encrypt_array(ARRAY[1, 2000], -1000, 1000, 42);
+SELECT range_value_at(2001, -1000, 1000, 42);
+SELECT range_encrypt_versioned(700, -1000, 1000, ARRAY[11, 22, 33], 0);
+SELECT range_encrypt_element(2, 1, 3, 42);
+SELECT range_decrypts_to(2, 1, 3, 42, 2);
@@ -0,0 +1,121 @@
+-- Exact outputs of the cipher, which must never change for a given
+-- range, key, algorithm and number of rounds, since they determine
+-- the values stored by the users of the extension.
+CREATE EXTENSION permuteseq;
+-- examples of the README
+SELECT range_encrypt_element(91919191919, 1e10::bigint, 1e11::bigint, 123456789012345);
+SELECT range_decrypt_element(83028080992, 1e10::bigint, 1e11::bigint, 123456789012345);
+-- first, middle and last values of ranges with all the algorithms
+SELECT a AS algorithm, range_encrypt_array(ARRAY[1, 2, 3, 4], 1, 4, 1, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY[0, 1, 2, 7, 14, 15], 0, 15, 12345, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY[-1000, -999, -998, 0, 999, 1000], -1000, 1000, 42, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY[-10000, -9999, -9998, 2500, 14999, 15000], -10000, 15000, 123456789012345, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY[1, 2, 3, 32768, 65535, 65536], 1, 65536, 987654321, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY[1, 2, 3, 32769, 65536, 65537], 1, 65537, 987654321, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY[-2147483648, -2147483647, -2147483646, -1, 2147483646, 2147483647], -2147483648, 2147483647, 7, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY[10000000000, 10000000001, 10000000002, 55000000000, 99999999999, 100000000000], 10000000000, 100000000000, 123456789012345, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY[-500000000000000000, -499999999999999999, -499999999999999998, 0, 499999999999999999, 500000000000000000], -500000000000000000, 500000000000000000, 4611686018427387904, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY[0, 1, 2, 2305843009213693953, 4611686018427387906, 4611686018427387907], 0, 4611686018427387907, -1, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY['-9223372036854775808'::bigint, -9223372036854775807, -9223372036854775806, -9223372036854775309, -9223372036854774810, -9223372036854774809], '-9223372036854775808'::bigint, -9223372036854774809, 99, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY[9223372036854774808, 9223372036854774809, 9223372036854774810, 9223372036854775307, 9223372036854775806, 9223372036854775807], 9223372036854774808, 9223372036854775807, -123456789, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY['-9223372036854775808'::bigint, -9223372036854775807, -9223372036854775806, -1, 9223372036854775806, 9223372036854775807], '-9223372036854775808'::bigint, 9223372036854775807, 0, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+SELECT a AS algorithm, range_encrypt_array(ARRAY['-9223372036854775808'::bigint, -9223372036854775807, -9223372036854775806, -1, 9223372036854775806, 9223372036854775807], '-9223372036854775808'::bigint, 9223372036854775807, -6917529027641081857, a) AS encrypted
+  FROM generate_series(1, 5) AS a;
+-- the first 1000 values of ranges, or all of them, hashed
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, 1, 4, 1, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(1, 4) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, 0, 15, 12345, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(0, 15) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, -1000, 1000, 42, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(-1000, -1) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, -10000, 15000, 123456789012345, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(-10000, -9001) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, 1, 65536, 987654321, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(1, 1000) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, 1, 65537, 987654321, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(1, 1000) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, -2147483648, 2147483647, 7, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(-2147483648, -2147482649) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, 10000000000, 100000000000, 123456789012345, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(10000000000, 10000000999) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, -500000000000000000, 500000000000000000, 4611686018427387904, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(-500000000000000000, -499999999999999001) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, 0, 4611686018427387907, -1, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(0, 999) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, '-9223372036854775808'::bigint, -9223372036854774809, 99, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series('-9223372036854775808'::bigint, -9223372036854774809) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, 9223372036854774808, 9223372036854775807, -123456789, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series(9223372036854774808, 9223372036854775807) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, '-9223372036854775808'::bigint, 9223372036854775807, 0, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series('-9223372036854775808'::bigint, -9223372036854774809) AS v
+  GROUP BY a ORDER BY a;
+SELECT a AS algorithm,
+       md5(string_agg(range_encrypt_element(v, '-9223372036854775808'::bigint, 9223372036854775807, -6917529027641081857, a)::text, ',' ORDER BY v)) AS hash
+  FROM generate_series(1, 5) AS a, generate_series('-9223372036854775808'::bigint, -9223372036854774809) AS v
+  GROUP BY a ORDER BY a;
+-- numbers of rounds
+SELECT r AS rounds, a AS algorithm,
+       range_encrypt_array(ARRAY[-1000, -999, 0, 999, 1000], -1000, 1000, 42, a, r) AS encrypted
+  FROM unnest(ARRAY[3, 6, 12, 32]) AS r, generate_series(1, 5) AS a
+  ORDER BY r, a;
+-- decryption is the inverse of encryption, value by value and in arrays
+SELECT count(*) AS mismatches
+  FROM generate_series(1, 5) AS a, generate_series(-1000, -1) AS v
+  WHERE range_decrypt_element(range_encrypt_element(v, -1000, 1000, 42, a), -1000, 1000, 42, a) <> v;
+SELECT count(*) AS mismatches
+  FROM generate_series(1, 5) AS a, generate_series(1, 1000) AS v
+  WHERE range_decrypt_element(range_encrypt_element(v, 1, 65537, 987654321, a), 1, 65537, 987654321, a) <> v;
+SELECT count(*) AS mismatches
+  FROM generate_series(1, 5) AS a, generate_series(9223372036854774808, 9223372036854775807) AS v
+  WHERE range_decrypt_element(range_encrypt_element(v, 9223372036854774808, 9223372036854775807, -123456789, a), 9223372036854774808, 9223372036854775807, -123456789, a) <> v;
+SELECT count(*) AS mismatches
+  FROM generate_series(1, 5) AS a, generate_series('-9223372036854775808'::bigint, -9223372036854774809) AS v
+  WHERE range_decrypt_element(range_encrypt_element(v, '-9223372036854775808'::bigint, 9223372036854775807, 0, a), '-9223372036854775808'::bigint, 9223372036854775807, 0, a) <> v;
+SELECT count(*) AS mismatches
+  FROM generate_series(1, 5) AS a,
+       LATERAL (SELECT array_agg(v ORDER BY v) AS vals FROM generate_series(-1000, 1000) AS v) AS s
+  WHERE range_decrypt_array(range_encrypt_array(vals, -1000, 1000, 42, a), -1000, 1000, 42, a) <> vals;
+-- the encryption of all the values of a range is a permutation of the range
+SELECT a AS algorithm, count(DISTINCT e) AS distinct_values, min(e) AS min, max(e) AS max
+  FROM generate_series(1, 5) AS a,
+       LATERAL (SELECT range_encrypt_element(v, -1000, 1000, 42, a) AS e
+                FROM generate_series(-1000, 1000) AS v) AS s
+  GROUP BY a ORDER BY a;
@@ -0,0 +1,58 @@
+-- Functions over sequences
+CREATE EXTENSION permuteseq;
+CREATE SEQUENCE s1 MINVALUE -1000 MAXVALUE 1000;
+SELECT permute_nextval('s1'::regclass, 42) AS value FROM generate_series(1, 5);
+SELECT permute_nextval_batch('s1'::regclass, 42, 5) AS value;
+SELECT permute_nextval_array('s1'::regclass, 42, 3) AS vals;
+SELECT currval('s1') AS position;
+SELECT reverse_permute('s1'::regclass, -665, 42) AS position,
+       permute_position('s1'::regclass, -1000, 42) AS value,
+       reverse_permutes_to('s1'::regclass, -665, 42, -1000) AS matches;
+SELECT reverse_permute_array('s1'::regclass, ARRAY[-780, NULL, 912], 42) AS positions;
+SELECT * FROM reverse_permute_rows('s1'::regclass, ARRAY[912, NULL, -665, -780], 42);
+SELECT reverse_permute('s1'::regclass, 1001, 42);
+SELECT reverse_permute_array('s1'::regclass, ARRAY[0, -1001], 42);
+-- options of the permutation of a sequence
+DO $$ BEGIN PERFORM permuteseq_set_options('s1', 3, 12); END $$;
+SELECT permute_nextval('s1'::regclass, 42) AS value;
+SELECT reverse_permute('s1'::regclass, -339, 42) AS position;
+SELECT permuteseq_set_options('s1', 0);
+-- registered sequences
+CREATE SEQUENCE s2 MINVALUE 1 MAXVALUE 1000000;
+DO $$ BEGIN PERFORM permuteseq_register('s2', 987654321, 5); END $$;
+SELECT permuteseq_nextval('s2') AS value FROM generate_series(1, 3);
+SELECT permuteseq_reverse('s2', 252366) AS position;
+-- preallocation
+SET permuteseq.prealloc_block_size = 4;
+SELECT permuteseq_nextval('s2') AS value FROM generate_series(1, 2);
+SELECT last_value AS position FROM s2;
+SELECT permute_nextval('s2'::regclass, 987654321) AS value;
+RESET permuteseq.prealloc_block_size;
+SELECT permuteseq_nextval('s2') AS value;
+SELECT permuteseq_nextval('s1');
+-- types
+SET client_min_messages = warning;
+SELECT permuteseq_create_type('s2_pos', 's2');
+RESET client_min_messages;
+SELECT 8::s2_pos AS value, '661764'::s2_pos::int8 AS position;
+SELECT count(*) FROM permuteseq_types;
+SET client_min_messages = warning;
+DROP TYPE s2_pos CASCADE;
+RESET client_min_messages;
+SELECT count(*) FROM permuteseq_types;
+-- versioned keys
+CREATE SEQUENCE s3 MINVALUE 1 MAXVALUE 1000;
+SELECT permute_nextval_versioned('s3'::regclass, ARRAY[5, 6], 1) AS value;
+SELECT permute_nextval_versioned('s3'::regclass, ARRAY[5, 6], 0) AS value;
+SELECT reverse_permute_versioned('s3'::regclass, 430, ARRAY[5, 6]) AS first,
+       reverse_permute_versioned('s3'::regclass, 933, ARRAY[5, 6]) AS second;
+SELECT setval('s3', 500) IS NOT NULL AS set;
+SELECT permute_nextval_versioned('s3'::regclass, ARRAY[5, 6], 0);
+-- the shortest sequences
+CREATE SEQUENCE s4 MINVALUE 1 MAXVALUE 4;
+SELECT reverse_permute('s4'::regclass, permute_nextval('s4'::regclass, 42), 42) AS position;
+CREATE SEQUENCE s5 MINVALUE 1 MAXVALUE 3;
+SELECT reverse_permutes_to('s5'::regclass, 1, 42, 1);
+SELECT reverse_permute('s5'::regclass, 1, 42);
+-- counters
+SELECT calls > 0 AS counted, context_misses > 0 AS initialized FROM permuteseq_stats;